@@ -0,0 +1,333 @@
+/*
+#
+# Copyright (C) 2010 by Chris Evich <cevich@redhat.com>
+#
+#   This library is free software; you can redistribute it and/or
+#   modify it under the terms of the GNU Lesser General Public
+#   License as published by the Free Software Foundation; either
+#   version 2.1 of the License, or (at your option) any later version.
+#
+#   This library is distributed in the hope that it will be useful,
+#   but WITHOUT ANY WARRANTY; without even the implied warranty of
+#   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+#   Lesser General Public License for more details.
+#
+#   You should have received a copy of the GNU Lesser General Public
+#   License along with this library; if not, write to the Free Software
+#   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+#
+*/
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include "utility.h"
+#include "arena.h"
+
+/**************************************************
+********************* PRIVATE FUNCTION DEFINITIONS
+**************************************************/
+
+/* notes ARENA_STOPSIG arrived */
+static void __arena_stop(int signum);
+
+/* returns offset of sequence's segment in arena */
+static off_t __arena_offset(unsigned long segsize, unsigned long segments,
+                            unsigned long sequence);
+
+/* maps just the header of sequence's segment in arena path, returning
+   it or NULL on failure */
+static arenahdr_t *__arena_maphdr(const char const *path, 
+                                  unsigned long segsize,
+                                  unsigned long segments,
+                                  unsigned long sequence);
+
+/* reads header of sequence's segment from fd into header.  Returns 0 if
+   it still holds sequence, non-zero otherwise */
+static int __arena_header(int fd, unsigned long segsize, 
+                          unsigned long segments, unsigned long sequence,
+                          arenahdr_t *header);
+
+/**************************************************
+********************* PRIVATE MACROS
+**************************************************/
+#define ARENA_MODE (S_IRUSR | S_IWUSR | S_IRGRP) /* of arena and extracts */
+#define ARENA_COPYLEN (256 * 1024) /* bytes copied at once by extract */
+
+/**************************************************
+********************* PRIVATE GLOBALS
+**************************************************/
+static volatile sig_atomic_t __arena_stopping=0;
+
+/**************************************************
+********************* PRIVATE FUNCTIONS
+**************************************************/
+
+static void __arena_stop(int signum) {
+    __arena_stopping = 1;
+}
+
+static off_t __arena_offset(unsigned long segsize, unsigned long segments,
+                            unsigned long sequence) {
+    /* sequences start at 1, reusing segments in ring order */
+    return (off_t) ((sequence - 1) % segments) * segsize;
+}
+
+static arenahdr_t *__arena_maphdr(const char const *path, 
+                                  unsigned long segsize,
+                                  unsigned long segments,
+                                  unsigned long sequence) {
+    arenahdr_t *header=NULL;
+    int fd=-1;
+
+    fd = open(path, O_RDWR | O_CLOEXEC);
+    if (fd < 0) {
+        fprintf(stderr, "ERROR: Open %s: %s\n", path, strerror(errno));
+        return NULL;
+    }
+    header = mmap(NULL, sizeof(arenahdr_t), PROT_READ | PROT_WRITE, 
+                  MAP_SHARED, fd, 
+                  __arena_offset(segsize, segments, sequence));
+    close(fd); /* mapping keeps it */
+    if (header == MAP_FAILED) {
+        fprintf(stderr, "ERROR: Map segment of %s: %s\n", path, 
+                strerror(errno));
+        return NULL;
+    }
+    return header;
+}
+
+static int __arena_header(int fd, unsigned long segsize, 
+                          unsigned long segments, unsigned long sequence,
+                          arenahdr_t *header) {
+    if (pread(fd, header, sizeof(arenahdr_t), 
+              __arena_offset(segsize, segments, sequence)) != 
+        sizeof(arenahdr_t))
+        return 1;
+    if ((header->magic != ARENA_MAGIC) || (header->sequence != sequence) ||
+        (header->length > segsize - sizeof(arenahdr_t)))
+        return 1; /* reused by a later run, or never written */
+    return 0;
+}
+
+/**************************************************
+********************* FUNCTIONS
+**************************************************/
+
+unsigned long arena_segsize(unsigned long requested) {
+    unsigned long page = sysconf(_SC_PAGESIZE);
+
+    requested += sizeof(arenahdr_t);
+    return ((requested + page - 1) / page) * page;
+}
+
+char *arena_path(const char const *outdir, const char const *name) {
+    return utility_strcat3(outdir, name, ARENA_SUFFIX);
+}
+
+int arena_create(const char const *path, unsigned long segsize,
+                 unsigned long segments) {
+    int fd=-1;
+    int result=0;
+
+    fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, ARENA_MODE);
+    if (fd < 0) {
+        fprintf(stderr, "ERROR: Create %s: %s\n", path, strerror(errno));
+        return 1;
+    }
+    /* every block allocated now, so runs never extend the file */
+    result = posix_fallocate(fd, 0, (off_t) segsize * segments);
+    if (result != 0)
+        fprintf(stderr, "ERROR: Preallocate %lu bytes for %s: %s\n",
+                segsize * segments, path, strerror(result));
+    close(fd);
+    if (result != 0)
+        unlink(path);
+    return result;
+}
+
+int arena_claim(const char const *path, unsigned long segsize,
+                unsigned long segments, unsigned long sequence) {
+    arenahdr_t *header=NULL;
+    pid_t owner=0;
+    int result=1;
+
+    header = __arena_maphdr(path, segsize, segments, sequence);
+    if (header == NULL)
+        return -1;
+    owner = __atomic_load_n(&(header->owner), __ATOMIC_ACQUIRE);
+    /* A killed ringwrap can't release, take back it's segment */
+    if (((owner == 0) || ((kill(owner, 0) != 0) && (errno == ESRCH))) &&
+        __atomic_compare_exchange_n(&(header->owner), &owner, getpid(), 0,
+                                    __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+        result = 0;
+    munmap(header, sizeof(arenahdr_t));
+    return result;
+}
+
+void arena_release(const char const *path, unsigned long segsize,
+                   unsigned long segments, unsigned long sequence) {
+    arenahdr_t *header=NULL;
+    pid_t mypid = getpid();
+
+    header = __arena_maphdr(path, segsize, segments, sequence);
+    if (header == NULL)
+        return;
+    /* might have been taken back if we were wrongly thought dead */
+    __atomic_compare_exchange_n(&(header->owner), &mypid, 0, 0,
+                                __ATOMIC_RELEASE, __ATOMIC_RELAXED);
+    munmap(header, sizeof(arenahdr_t));
+}
+
+int arena_drain(int infd, const char const *path, unsigned long segsize,
+                unsigned long segments, unsigned long sequence) {
+    arenahdr_t *header=NULL;
+    char *data=NULL;
+    unsigned long room=0;
+    char discard[4096];
+    ssize_t got=0;
+    int fd=-1;
+    struct pollfd pfd;
+    struct sigaction stop;
+    sigset_t unblocked;
+
+    fd = open(path, O_RDWR | O_CLOEXEC);
+    if (fd >= 0)
+        header = mmap(NULL, segsize, PROT_READ | PROT_WRITE, MAP_SHARED, fd,
+                      __arena_offset(segsize, segments, sequence));
+    if ((fd < 0) || (header == MAP_FAILED)) {
+        fprintf(stderr, "ERROR: Map segment of %s: %s\n", path, 
+                strerror(errno));
+        if (fd >= 0)
+            close(fd);
+        close(infd);
+        return 1;
+    }
+    close(fd); /* mapping keeps it */
+    /* header invalid until the run is complete, owner stays ours */
+    __atomic_store_n(&(header->magic), 0, __ATOMIC_RELEASE);
+    header->sequence = 0;
+    header->length = 0;
+    header->dropped = 0;
+    data = (char *) (header + 1);
+    room = segsize - sizeof(arenahdr_t);
+    memset(&stop, 0, sizeof(struct sigaction));
+    stop.sa_handler = __arena_stop;
+    sigaction(ARENA_STOPSIG, &stop, NULL);
+    sigprocmask(SIG_SETMASK, NULL, &unblocked);
+    sigdelset(&unblocked, ARENA_STOPSIG);
+    fcntl(infd, F_SETFL, fcntl(infd, F_GETFL) | O_NONBLOCK);
+    pfd.fd = infd;
+    pfd.events = POLLIN;
+    while (1) {
+        /* Until told to stop, wait for more.  Any process of the command
+           still holding the pipe can't keep us from finishing then */
+        if ((__arena_stopping == 0) &&
+            (ppoll(&pfd, 1, NULL, &unblocked) < 0) && (errno != EINTR))
+            break;
+        if (header->length < room)
+            got = read(infd, data + header->length, room - header->length);
+        else /* full, count what doesn't fit */
+            got = read(infd, discard, sizeof(discard));
+        if (got == 0)
+            break; /* all writers closed */
+        if (got < 0) {
+            if (errno == EINTR)
+                continue;
+            if ((errno == EAGAIN) && (__arena_stopping == 0))
+                continue;
+            break; /* nothing left waiting, or failed */
+        }
+        if (header->length < room)
+            header->length += got;
+        else
+            header->dropped += got;
+    }
+    close(infd);
+    header->sequence = sequence;
+    /* readers check magic, set it last.  Our parent releases it's claim
+       once the run is in the logring */
+    __atomic_store_n(&(header->magic), ARENA_MAGIC, __ATOMIC_RELEASE);
+    munmap(header, segsize);
+    return 0;
+}
+
+long arena_length(const char const *path, unsigned long segsize,
+                  unsigned long segments, unsigned long sequence) {
+    arenahdr_t header;
+    int fd=-1;
+    int result=0;
+
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return -1;
+    result = __arena_header(fd, segsize, segments, sequence, &header);
+    close(fd);
+    if (result != 0)
+        return -1;
+    return header.length;
+}
+
+int arena_extract(const char const *path, unsigned long segsize,
+                  unsigned long segments, unsigned long sequence,
+                  const char const *outpath) {
+    arenahdr_t header;
+    char *buffer=NULL;
+    off_t offset=0;
+    unsigned long left=0;
+    ssize_t length=0;
+    int fd=-1;
+    int outfd=-1;
+    int result=0;
+
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        fprintf(stderr, "ERROR: Open %s: %s\n", path, strerror(errno));
+        return 1;
+    }
+    if (__arena_header(fd, segsize, segments, sequence, &header) != 0) {
+        fprintf(stderr, "ERROR: Run %lu was overwritten in %s\n", sequence,
+                path);
+        close(fd);
+        return 1;
+    }
+    outfd = open(outpath, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 
+                 ARENA_MODE);
+    if (outfd < 0) {
+        fprintf(stderr, "ERROR: Create %s: %s\n", outpath, strerror(errno));
+        close(fd);
+        return 1;
+    }
+    buffer = malloc(ARENA_COPYLEN);
+    offset = __arena_offset(segsize, segments, sequence) + 
+             sizeof(arenahdr_t);
+    for (left = header.length; (left > 0) && (result == 0); 
+         left -= length, offset += length) {
+        length = pread(fd, buffer, 
+                       (left < ARENA_COPYLEN) ? left : ARENA_COPYLEN, offset);
+        if ((length <= 0) || (write(outfd, buffer, length) != length)) {
+            fprintf(stderr, "ERROR: Copy to %s: %s\n", outpath, 
+                    strerror(errno));
+            result = 1;
+            length = 0;
+        }
+    }
+    free(buffer);
+    close(fd);
+    if (close(outfd) != 0)
+        result = 1;
+    if ((result == 0) && (header.dropped > 0))
+        fprintf(stderr, "WARNING: Last %lu bytes of run %lu did not fit "
+                        "in it's segment\n", header.dropped, sequence);
+    if (result != 0)
+        unlink(outpath);
+    return result;
+}
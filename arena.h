@@ -0,0 +1,96 @@
+/*
+#
+# Copyright (C) 2010 by Chris Evich <cevich@redhat.com>
+#
+#   This library is free software; you can redistribute it and/or
+#   modify it under the terms of the GNU Lesser General Public
+#   License as published by the Free Software Foundation; either
+#   version 2.1 of the License, or (at your option) any later version.
+#
+#   This library is distributed in the hope that it will be useful,
+#   but WITHOUT ANY WARRANTY; without even the implied warranty of
+#   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+#   Lesser General Public License for more details.
+#
+#   You should have received a copy of the GNU Lesser General Public
+#   License along with this library; if not, write to the Free Software
+#   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+#
+*/
+
+#ifndef _ARENA_H
+#define _ARENA_H
+
+/* users of this need: 
+    #include <sys/types.h>
+*/
+
+/**************************************************
+********************* MACROS
+**************************************************/
+#define ARENA_SUFFIX ".arena" /* appended to ring name for arena file */
+#define ARENA_SPARE 16 /* segments beyond keep, for runs still in flight */
+#define ARENA_MAGIC 0x7061727777676e72UL /* "rngwwrap" in every header */
+#define ARENA_STOPSIG SIGUSR1 /* tells arena_drain() the wrapper is done */
+
+/**************************************************
+********************* TYPES
+**************************************************/
+
+/* Start of every arena segment, output follows it */
+typedef struct arenahdr_s {
+    unsigned long magic; /* ARENA_MAGIC once a run wrote the segment */
+    unsigned long sequence; /* arena sequence of run in segment */
+    unsigned long length; /* bytes of output following header */
+    unsigned long dropped; /* bytes of output that didn't fit */
+    pid_t owner; /* ringwrap whose run is writing segment or 0 */
+} arenahdr_t;
+
+/**************************************************
+********************* FUNCTION DEFINITIONS
+**************************************************/
+
+/* returns requested output bytes per run plus header, rounded up to 
+   whole pages so every segment can be mapped on it's own */
+unsigned long arena_segsize(unsigned long requested);
+
+/* returns newly allocated path of arena file for ring name in outdir */
+char *arena_path(const char const *outdir, const char const *name);
+
+/* creates (or truncates) and preallocates arena file of segments 
+   segments, segsize bytes each.  Returns 0 on success, non-zero on 
+   failure */
+int arena_create(const char const *path, unsigned long segsize,
+                 unsigned long segments);
+
+/* claims sequence's segment for the calling process, unless a live
+   process is still writing or logging it.  Returns 0 if claimed, 1 if
+   busy, -1 on failure */
+int arena_claim(const char const *path, unsigned long segsize,
+                unsigned long segments, unsigned long sequence);
+
+/* gives up claim on sequence's segment by arena_claim(), once it's
+   run is logged or if it won't be written after all */
+void arena_release(const char const *path, unsigned long segsize,
+                   unsigned long segments, unsigned long sequence);
+
+/* reads infd into the segment of arena path for sequence until EOF, or
+   once ARENA_STOPSIG arrived, until no more is waiting.  Expects 
+   ARENA_STOPSIG to be blocked already.  Closes infd, the segment's
+   arena_claim() by our parent stays.  Returns 0 on success, non-zero
+   on failure */
+int arena_drain(int infd, const char const *path, unsigned long segsize,
+                unsigned long segments, unsigned long sequence);
+
+/* returns bytes of output sequence left in arena path, or -1 if
+   it's segment was reused or can't be read */
+long arena_length(const char const *path, unsigned long segsize,
+                  unsigned long segments, unsigned long sequence);
+
+/* copies output sequence left in arena path into new file outpath. 
+   Returns 0 on success, non-zero on failure */
+int arena_extract(const char const *path, unsigned long segsize,
+                  unsigned long segments, unsigned long sequence,
+                  const char const *outpath);
+
+#endif /* _ARENA_H */
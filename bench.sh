@@ -0,0 +1,91 @@
+#!/bin/sh
+#
+# Copyright (C) 2010 by Chris Evich <cevich@redhat.com>
+#
+#   This library is free software; you can redistribute it and/or
+#   modify it under the terms of the GNU Lesser General Public
+#   License as published by the Free Software Foundation; either
+#   version 2.1 of the License, or (at your option) any later version.
+#
+#   This library is distributed in the hope that it will be useful,
+#   but WITHOUT ANY WARRANTY; without even the implied warranty of
+#   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+#   Lesser General Public License for more details.
+#
+#   You should have received a copy of the GNU Lesser General Public
+#   License along with this library; if not, write to the Free Software
+#   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+#
+#
+#Use: bench.sh [runs]
+#     Measures what ringwrap adds to every execution of a trivial command,
+#     running it runs times (default 1000) in each of four modes:
+#       bare      - the command alone
+#       uninit    - through ringwrap, with no shared data initialized
+#       unwrapped - through ringwrap, initialized but not begun
+#       wrapped   - through ringwrap, begun with a no-op wrapper
+#     Prints CSV "mode,metric,runs,mean_ns" to stdout.  The wall metric
+#     is measured here, all others come from the "bench:" line a
+#     ringwrap built with -DBENCHMARK (see 'make bench') prints.
+#Env: RINGWRAP      ringwrap binary to use (default ./ringwrap)
+#     RINGWRAPFLAGS extra options for every ringwrap, e.g. -r or -n
+#     COMMAND       command to execute (default /bin/true)
+
+RUNS=${1:-1000}
+RINGWRAP=${RINGWRAP:-./ringwrap}
+COMMAND=${COMMAND:-/bin/true}
+UNIQUE="bench$$"
+WRAPPER="env --" # runs the command, nothing else
+LOG=$(mktemp) || exit 1
+trap 'rm -f "$LOG"; $RINGWRAP $RINGWRAPFLAGS -u $UNIQUE -f $COMMAND \
+      >/dev/null 2>&1' EXIT
+
+now() {
+    date +%s%N
+}
+
+# run_mode <mode> <command...>: time runs executions, then summarize
+run_mode() {
+    mode=$1
+    shift
+    : > "$LOG"
+    counter=0
+    start=$(now)
+    while [ $counter -lt $RUNS ]; do
+        "$@" 2>> "$LOG"
+        counter=$((counter + 1))
+    done
+    end=$(now)
+    echo "$mode,wall,$RUNS,$(( (end - start) / RUNS ))"
+    awk -v mode="$mode" '
+        $1 == "bench:" {
+            n++
+            for (i = 2; i <= NF; i++) {
+                split($i, kv, "=")
+                if (kv[1] ~ /_ns$/) {
+                    if (!(kv[1] in sum))
+                        order[++fields] = kv[1]
+                    sum[kv[1]] += kv[2]
+                }
+            }
+        }
+        END {
+            for (i = 1; i <= fields; i++)
+                printf "%s,%s,%d,%d\n", mode, order[i], n, sum[order[i]] / n
+        }' "$LOG"
+}
+
+if ! $RINGWRAP $RINGWRAPFLAGS -u $UNIQUE $COMMAND 2>&1 | grep -q "^bench:"
+then
+    echo "WARNING: $RINGWRAP not built with -DBENCHMARK," \
+         "only wall times measured" >&2
+fi
+
+echo "mode,metric,runs,mean_ns"
+run_mode bare $COMMAND
+run_mode uninit $RINGWRAP $RINGWRAPFLAGS -u $UNIQUE $COMMAND
+$RINGWRAP $RINGWRAPFLAGS -u $UNIQUE -w "$WRAPPER" -i $COMMAND >/dev/null 2>&1 \
+    || { echo "ERROR: Initializing $UNIQUE failed" >&2; exit 1; }
+run_mode unwrapped $RINGWRAP $RINGWRAPFLAGS -u $UNIQUE $COMMAND
+$RINGWRAP $RINGWRAPFLAGS -u $UNIQUE -b $COMMAND >/dev/null 2>&1
+run_mode wrapped $RINGWRAP $RINGWRAPFLAGS -u $UNIQUE $COMMAND
@@ -0,0 +1,73 @@
+/*
+#
+# Copyright (C) 2010 by Chris Evich <cevich@redhat.com>
+#
+#   This library is free software; you can redistribute it and/or
+#   modify it under the terms of the GNU Lesser General Public
+#   License as published by the Free Software Foundation; either
+#   version 2.1 of the License, or (at your option) any later version.
+#
+#   This library is distributed in the hope that it will be useful,
+#   but WITHOUT ANY WARRANTY; without even the implied warranty of
+#   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+#   Lesser General Public License for more details.
+#
+#   You should have received a copy of the GNU Lesser General Public
+#   License along with this library; if not, write to the Free Software
+#   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+#
+*/
+
+#include <sys/types.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <zlib.h>
+#include "compress.h"
+
+/**************************************************
+********************* FUNCTIONS
+**************************************************/
+
+int compress_fd(int infd, const char const *outpath) {
+    gzFile gz=NULL;
+    char *buffer=NULL;
+    ssize_t length=0;
+    int result=0;
+
+    gz = gzopen(outpath, COMPRESS_MODE);
+    if (gz == NULL) {
+        fprintf(stderr, "ERROR: Open %s: %s\n", outpath, strerror(errno));
+        return 1;
+    }
+    /* one large read feeds one deflate call, zlib's own buffer matches */
+    gzbuffer(gz, COMPRESS_BUFLEN);
+    buffer = malloc(COMPRESS_BUFLEN);
+    while (1) {
+        length = read(infd, buffer, COMPRESS_BUFLEN);
+        if (length == 0)
+            break; /* all writers closed */
+        if (length < 0) {
+            if (errno == EINTR)
+                continue;
+            fprintf(stderr, "ERROR: Read for %s: %s\n", outpath,
+                    strerror(errno));
+            result = 1;
+            break;
+        }
+        if (gzwrite(gz, buffer, length) != length) {
+            fprintf(stderr, "ERROR: Write %s: %s\n", outpath,
+                    gzerror(gz, NULL));
+            result = 1;
+            break;
+        }
+    }
+    free(buffer);
+    if (gzclose(gz) != Z_OK) {
+        fprintf(stderr, "ERROR: Close %s\n", outpath);
+        result = 1;
+    }
+    return result;
+}
@@ -0,0 +1,44 @@
+/*
+#
+# Copyright (C) 2010 by Chris Evich <cevich@redhat.com>
+#
+#   This library is free software; you can redistribute it and/or
+#   modify it under the terms of the GNU Lesser General Public
+#   License as published by the Free Software Foundation; either
+#   version 2.1 of the License, or (at your option) any later version.
+#
+#   This library is distributed in the hope that it will be useful,
+#   but WITHOUT ANY WARRANTY; without even the implied warranty of
+#   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+#   Lesser General Public License for more details.
+#
+#   You should have received a copy of the GNU Lesser General Public
+#   License along with this library; if not, write to the Free Software
+#   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+#
+*/
+
+#ifndef _COMPRESS_H
+#define _COMPRESS_H
+
+/* users of this need: 
+    #include <sys/types.h>
+*/
+
+/**************************************************
+********************* MACROS
+**************************************************/
+#define COMPRESS_SUFFIX ".gz" /* appended to compressed file names */
+#define COMPRESS_MODE "wb1" /* gzopen() mode, trace text compresses well
+                               even at the fastest level */
+#define COMPRESS_BUFLEN (256 * 1024) /* bytes read and deflated at once */
+
+/**************************************************
+********************* FUNCTION DEFINITIONS
+**************************************************/
+
+/* reads infd until EOF, writing it gzip compressed into new file outpath.
+   Returns 0 on success, non-zero on failure */
+int compress_fd(int infd, const char const *outpath);
+
+#endif /* _COMPRESS_H */
@@ -0,0 +1,207 @@
+/*
+#
+# Copyright (C) 2010 by Chris Evich <cevich@redhat.com>
+#
+#   This library is free software; you can redistribute it and/or
+#   modify it under the terms of the GNU Lesser General Public
+#   License as published by the Free Software Foundation; either
+#   version 2.1 of the License, or (at your option) any later version.
+#
+#   This library is distributed in the hope that it will be useful,
+#   but WITHOUT ANY WARRANTY; without even the implied warranty of
+#   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+#   Lesser General Public License for more details.
+#
+#   You should have received a copy of the GNU Lesser General Public
+#   License along with this library; if not, write to the Free Software
+#   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+#
+*/
+
+#include <sys/types.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <semaphore.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <errno.h>
+#include <time.h>
+#include "version.h"
+#include "utility.h"
+#include "histogram.h"
+#include "registry.h"
+#include "ring.h"
+#include "evict.h"
+
+/**************************************************
+********************* PRIVATE FUNCTION DEFINITIONS
+**************************************************/
+/* returns name of path inside basedir, or NULL if path is not directly
+   inside it or basedir is / */
+static const char *__basedir_name(const char const *basedir,
+                                  const char const *path);
+
+/* empties evicted entry into a new spare directory and queues it for
+   outputdir(), freeing entry.  Returns non-zero, entry untouched, if
+   it's not to be recycled or that failed */
+static int __recycle(shared_t *shared, const config_t *config, char *entry);
+
+/**************************************************
+********************* PRIVATE FUNCTIONS
+**************************************************/
+static const char *__basedir_name(const char const *basedir,
+                                  const char const *path) {
+    const char *name=NULL;
+    size_t baselen=0;
+
+    if (basedir != NULL)
+        baselen = strlen(basedir);
+    name = path + baselen;
+    /* Same spirit as rm --preserve-root, plus never leave basedir */
+    if ( (baselen == 0) || (strcmp(basedir, "/") == 0) ||
+         (basedir[baselen - 1] != '/') || /* utility_fixpath()'d */
+         (strncmp(path, basedir, baselen) != 0) ||
+         (*name == '\0') || (strchr(name, '/') != NULL) ||
+         (strcmp(name, ".") == 0) || (strcmp(name, "..") == 0) )
+        return NULL;
+    return name;
+}
+
+static int __recycle(shared_t *shared, const config_t *config, char *entry) {
+    char sparename[MAXDIRSTRLEN];
+    char *spare=NULL;
+    evictstats_t evictstats;
+
+    get_evictstats(shared, &evictstats);
+    /* worker is the only one queueing spares, so room can't vanish */
+    if ((config->recycle == 0) || (evictstats.sparecount >= SPAREQUEUELEN) ||
+        (evictworker_registered(shared) == 0)) /* stopping, no reuse */
+        return 1;
+    snprintf(sparename, MAXDIRSTRLEN, SPAREPREFIX"%lu", spare_next(shared));
+    spare = utility_fullpath(config->outdir, sparename);
+    if (recycledir(config->outdir, entry, config->recyclekeep, spare) != 0) {
+        free(spare);
+        return 1;
+    }
+    free(entry);
+    if (spare_push(shared, spare) != 0)
+        return deldir(config->outdir, spare); /* frees */
+    free(spare);
+    return 0;
+}
+
+/**************************************************
+********************* FUNCTIONS
+**************************************************/
+
+int deldir(const char const *basedir, char *delandfree) {
+    const char *name=NULL;
+    int dirfd=-1;
+    int result=0;
+
+    if (delandfree == NULL)
+        return 0;
+    name = __basedir_name(basedir, delandfree);
+    if (name == NULL) {
+        fprintf(stderr, "ERROR: Refusing to remove %s, not in %s\n",
+                delandfree, basedir);
+        free(delandfree);
+        return 1;
+    }
+    dirfd = open(basedir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dirfd < 0) {
+        fprintf(stderr, "ERROR: Open %s: %s\n", basedir, strerror(errno));
+        result = 1;
+    } else {
+        result = utility_rmtree(dirfd, name, delandfree);
+        close(dirfd);
+    }
+    if (result != 0)
+        fprintf(stderr, "ERROR: %s removal failed.\n", delandfree);
+    free(delandfree);
+    return result;
+}
+
+int recycledir(const char const *basedir, const char const *path,
+               const char const *keep, const char const *spare) {
+    const char *name=NULL;
+    const char *sparename=NULL;
+    int basefd=-1;
+    int fd=-1;
+    int keepfd=-1;
+    int failures=0;
+    DIR *dir=NULL;
+    struct dirent *entry=NULL;
+    char *entrypath=NULL;
+
+    name = __basedir_name(basedir, path);
+    sparename = __basedir_name(basedir, spare);
+    if ((name == NULL) || (sparename == NULL)) {
+        fprintf(stderr, "ERROR: Refusing to recycle %s, not in %s\n",
+                path, basedir);
+        return 1;
+    }
+    basefd = open(basedir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (basefd < 0) {
+        fprintf(stderr, "ERROR: Open %s: %s\n", basedir, strerror(errno));
+        return 1;
+    }
+    fd = openat(basefd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    if ((fd < 0) || ((dir = fdopendir(fd)) == NULL)) { /* dir owns fd */
+        fprintf(stderr, "ERROR: Open %s: %s\n", path, strerror(errno));
+        if (fd >= 0)
+            close(fd);
+        close(basefd);
+        return 1;
+    }
+    while ((entry = readdir(dir)) != NULL) {
+        if ((strcmp(entry->d_name, ".") == 0) ||
+            (strcmp(entry->d_name, "..") == 0))
+            continue;
+        /* next run's wrapper overwrites the same inode */
+        if ((keep != NULL) && (strcmp(entry->d_name, keep) == 0) &&
+            ((keepfd = openat(fd, entry->d_name, O_WRONLY | O_TRUNC | 
+                              O_NOFOLLOW | O_NONBLOCK | O_CLOEXEC)) >= 0)) {
+            close(keepfd);
+            continue;
+        } /* anything else, e.g. strace -ff's per PID files, goes */
+        entrypath = utility_fullpath(path, entry->d_name);
+        failures += utility_rmtree(fd, entry->d_name, entrypath);
+        free(entrypath);
+    }
+    closedir(dir);
+    if ((failures == 0) && (renameat(basefd, name, basefd, sparename) != 0)) {
+        fprintf(stderr, "ERROR: Rename %s to %s: %s\n", path, spare,
+                strerror(errno));
+        failures++;
+    }
+    close(basefd);
+    return failures;
+}
+
+void evictworker(shared_t *shared) {
+    char *entries[EVICTBATCH];
+    char *spare=NULL;
+    size_t dequeued=0;
+    size_t failed=0;
+    size_t counter=0;
+    config_t config;
+
+    get_config(shared, &config);
+    do {
+        dequeued = evict_dequeue(shared, entries, EVICTBATCH, EVICTIDLE);
+        for (failed = 0, counter = 0; counter < dequeued; counter++)
+            if ((__recycle(shared, &config, entries[counter]) != 0) &&
+                (deldir(config.outdir, entries[counter]) != 0)) /* frees */
+                failed++;
+        if (dequeued > 0)
+            evict_done(shared, dequeued - failed, failed);
+        /* once stopped, keep going until queue is drained */
+    } while ((evictworker_registered(shared) == 1) || (dequeued > 0));
+    /* nobody will take what's left once stopped */
+    while ((spare = spare_pop(shared)) != NULL)
+        deldir(config.outdir, spare); /* frees */
+}
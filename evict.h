@@ -0,0 +1,58 @@
+/*
+#
+# Copyright (C) 2010 by Chris Evich <cevich@redhat.com>
+#
+#   This library is free software; you can redistribute it and/or
+#   modify it under the terms of the GNU Lesser General Public
+#   License as published by the Free Software Foundation; either
+#   version 2.1 of the License, or (at your option) any later version.
+#
+#   This library is distributed in the hope that it will be useful,
+#   but WITHOUT ANY WARRANTY; without even the implied warranty of
+#   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+#   Lesser General Public License for more details.
+#
+#   You should have received a copy of the GNU Lesser General Public
+#   License along with this library; if not, write to the Free Software
+#   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+#
+*/
+
+#ifndef _EVICT_H
+#define _EVICT_H
+
+/* users of this need: 
+    #include <semaphore.h>
+    #include <pthread.h>
+    #include "histogram.h"
+    #include "registry.h"
+    #include "ring.h"
+*/
+
+/**************************************************
+********************* MACROS
+**************************************************/
+#define EVICTBATCH 16 /* max directories eviction worker dequeues at once */
+#define EVICTIDLE 1 /* seconds eviction worker waits before rechecking */
+
+/**************************************************
+********************* FUNCTION DEFINITIONS
+**************************************************/
+
+/* recursivly removes path pointed to by delandfree then frees delandfree.
+   Refuses anything not directly inside basedir, or basedir being /.
+   returns non-zero on failiure */
+int deldir(const char const *basedir, char *delandfree);
+
+/* empties directory path, except for any file named keep which is 
+   truncated instead, then renames it to spare.  Refuses either not being
+   directly inside basedir.  Returns non-zero on failure, path may then
+   be partially emptied */
+int recycledir(const char const *basedir, const char const *path,
+               const char const *keep, const char const *spare);
+
+/* removes, or with recycling on empties for reuse, batches of evicted
+   directories until evictworker_stop(), then any spares left over */
+void evictworker(shared_t *shared);
+
+#endif /* _EVICT_H */
@@ -0,0 +1,527 @@
+/*
+#
+# Copyright (C) 2010 by Chris Evich <cevich@redhat.com>
+#
+#   This library is free software; you can redistribute it and/or
+#   modify it under the terms of the GNU Lesser General Public
+#   License as published by the Free Software Foundation; either
+#   version 2.1 of the License, or (at your option) any later version.
+#
+#   This library is distributed in the hope that it will be useful,
+#   but WITHOUT ANY WARRANTY; without even the implied warranty of
+#   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+#   Lesser General Public License for more details.
+#
+#   You should have received a copy of the GNU Lesser General Public
+#   License along with this library; if not, write to the Free Software
+#   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+#
+*/
+
+#include <sys/types.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <semaphore.h>
+#include <pthread.h>
+#include <time.h>
+#include "version.h"
+#include "utility.h"
+#include "histogram.h"
+#include "registry.h"
+#include "ring.h"
+#include "export.h"
+
+/**************************************************
+********************* PRIVATE FUNCTION DEFINITIONS
+**************************************************/
+
+/* writes value to out as a quoted, escaped JSON string */
+static void __json_string(FILE *out, const char const *value);
+
+/* writes latency summary of histogram to out as a JSON object */
+static void __json_latency(FILE *out, const histogram_t *histogram);
+
+/* writes totals and maxima of usage to out as a JSON object */
+static void __json_usage(FILE *out, const usage_t *usage);
+
+/* writes value to out as a quoted, escaped prometheus label value */
+static void __prom_label(FILE *out, const char const *value);
+
+/* writes HELP and TYPE lines of metric */
+static void __prom_header(FILE *out, const char const *metric,
+                          const char const *type, const char const *help);
+
+/* writes one sample of metric for ring name, with an optional extra 
+   label (NULL for none) */
+static void __prom_sample(FILE *out, const char const *metric,
+                          const char const *name, const char const *label,
+                          const char const *labelvalue, double value);
+
+/* writes latency summary samples of histogram for ring name */
+static void __prom_latency(FILE *out, const char const *name, 
+                           const char const *wrapped,
+                           const histogram_t *histogram);
+
+/* returns name of sampling policy */
+static const char *__sample_policy(const sample_t *sample);
+
+/* returns seconds between snapshot's created and taken, at least 1 */
+static double __uptime(const snapshot_t *snapshot);
+
+/**************************************************
+********************* PRIVATE MACROS
+**************************************************/
+#define ATOMIC_GET(ptr) __atomic_load_n((ptr), __ATOMIC_ACQUIRE)
+#define JSONBOOL(value) (((value) == 1) ? "true" : "false")
+
+/**************************************************
+********************* PRIVATE GLOBALS
+**************************************************/
+static const double __quantiles[] = { 50.0, 90.0, 99.0, 99.9 };
+#define QUANTILES (sizeof(__quantiles) / sizeof(double))
+/* indexed by usagefield_t */
+static const char const *__usagenames[USAGE_FIELDS] = {
+    "user_cpu_microseconds", "system_cpu_microseconds", "max_rss_kibibytes",
+    "voluntary_switches", "involuntary_switches", "block_inputs", 
+    "block_outputs" };
+
+/**************************************************
+********************* PRIVATE FUNCTIONS
+**************************************************/
+
+static void __json_string(FILE *out, const char const *value) {
+    fputc('"', out);
+    for (; *value != '\0'; value++) {
+        if ((*value == '"') || (*value == '\\'))
+            fprintf(out, "\\%c", *value);
+        else if ((unsigned char) *value < 0x20)
+            fprintf(out, "\\u%04x", (unsigned char) *value);
+        else
+            fputc(*value, out);
+    }
+    fputc('"', out);
+}
+
+static void __json_latency(FILE *out, const histogram_t *histogram) {
+    fprintf(out, "{\"count\": %lu, \"sum\": %lu, \"mean\": %lu, "
+                 "\"p50\": %lu, \"p90\": %lu, \"p99\": %lu, "
+                 "\"p99.9\": %lu, \"max\": %lu}",
+            histogram->count, histogram->sum, histogram_mean(histogram),
+            histogram_percentile(histogram, 50.0),
+            histogram_percentile(histogram, 90.0),
+            histogram_percentile(histogram, 99.0),
+            histogram_percentile(histogram, 99.9), histogram->max);
+}
+
+static void __json_usage(FILE *out, const usage_t *usage) {
+    size_t field=0;
+
+    fprintf(out, "{\"runs\": %lu, \"total\": {", usage->runs);
+    for (; field < USAGE_FIELDS; field++)
+        fprintf(out, "%s\"%s\": %lu", (field > 0) ? ", " : "", 
+                __usagenames[field], usage->total[field]);
+    fprintf(out, "}, \"max\": {");
+    for (field = 0; field < USAGE_FIELDS; field++)
+        fprintf(out, "%s\"%s\": %lu", (field > 0) ? ", " : "",
+                __usagenames[field], usage->max[field]);
+    fprintf(out, "}}");
+}
+
+static void __prom_label(FILE *out, const char const *value) {
+    fputc('"', out);
+    for (; *value != '\0'; value++) {
+        if ((*value == '"') || (*value == '\\'))
+            fprintf(out, "\\%c", *value);
+        else if (*value == '\n')
+            fputs("\\n", out);
+        else
+            fputc(*value, out);
+    }
+    fputc('"', out);
+}
+
+static void __prom_header(FILE *out, const char const *metric,
+                          const char const *type, const char const *help) {
+    fprintf(out, "# HELP "EXPORT_PREFIX"%s %s\n", metric, help);
+    fprintf(out, "# TYPE "EXPORT_PREFIX"%s %s\n", metric, type);
+}
+
+static void __prom_sample(FILE *out, const char const *metric,
+                          const char const *name, const char const *label,
+                          const char const *labelvalue, double value) {
+    fprintf(out, EXPORT_PREFIX"%s{ring=", metric);
+    __prom_label(out, name);
+    if (label != NULL) {
+        fprintf(out, ",%s=", label);
+        __prom_label(out, labelvalue);
+    }
+    fprintf(out, "} %.17g\n", value);
+}
+
+static void __prom_latency(FILE *out, const char const *name, 
+                           const char const *wrapped,
+                           const histogram_t *histogram) {
+    size_t counter=0;
+
+    for (; counter < QUANTILES; counter++) {
+        fprintf(out, EXPORT_PREFIX"latency_microseconds{ring=");
+        __prom_label(out, name);
+        fprintf(out, ",wrapped=\"%s\",quantile=\"%g\"} %lu\n", wrapped,
+                __quantiles[counter] / 100.0,
+                histogram_percentile(histogram, __quantiles[counter]));
+    }
+    __prom_sample(out, "latency_microseconds_sum", name, "wrapped", wrapped,
+                  histogram->sum);
+    __prom_sample(out, "latency_microseconds_count", name, "wrapped", 
+                  wrapped, histogram->count);
+}
+
+static const char *__sample_policy(const sample_t *sample) {
+    switch (sample->policy) {
+        case SAMPLE_EVERY:
+            return "every";
+        case SAMPLE_PROBABILITY:
+            return "probability";
+        case SAMPLE_RATE:
+            return "rate";
+        default:
+            return "all";
+    }
+}
+
+static double __uptime(const snapshot_t *snapshot) {
+    if (snapshot->taken <= snapshot->created)
+        return 1.0;
+    return snapshot->taken - snapshot->created;
+}
+
+/**************************************************
+********************* FUNCTIONS
+**************************************************/
+
+void export_snapshot(shared_t *shared, snapshot_t *snapshot) {
+    memset(snapshot, 0, sizeof(snapshot_t));
+    snapshot->taken = time(NULL);
+    snapshot->created = shared->shmseg->created; /* never changes */
+    snapshot->generation = get_generation(shared);
+    snapshot->eventwatcher = ATOMIC_GET(&(shared->shmseg->eventwatcher));
+    snapshot->samplecount = ATOMIC_GET(&(shared->shmseg->samplecount));
+    get_config(shared, &(snapshot->config));
+    get_windowleft(shared, &(snapshot->config), &(snapshot->windowseconds),
+                   &(snapshot->windowruns));
+    get_counters(shared, &(snapshot->counters));
+    get_evictstats(shared, &(snapshot->evictstats));
+    get_latency(shared, 1, &(snapshot->wrappedlatency));
+    get_latency(shared, 0, &(snapshot->unwrappedlatency));
+    get_arm(shared, &(snapshot->arm));
+    get_usage(shared, 1, &(snapshot->wrappedusage));
+    get_usage(shared, 0, &(snapshot->unwrappedusage));
+    snapshot->logged = get_logring(shared, &(snapshot->logring));
+}
+
+void export_free(snapshot_t *snapshot) {
+    free(snapshot->logring);
+    memset(snapshot, 0, sizeof(snapshot_t));
+}
+
+void export_json(FILE *out, const char const *name, 
+                 const char const *command, const snapshot_t *snapshot) {
+    const counters_t *counters = &(snapshot->counters);
+    const config_t *config = &(snapshot->config);
+    const evictstats_t *evictstats = &(snapshot->evictstats);
+    unsigned long counter=0;
+    unsigned long executions=0;
+
+    executions = counters->wrappedexecutions + counters->unwrappedexecutions;
+    fprintf(out, "{\n  \"ring\": ");
+    __json_string(out, name);
+    fprintf(out, ",\n  \"command\": ");
+    __json_string(out, command);
+    fprintf(out, ",\n  \"taken\": %ld,\n  \"created\": %ld,\n"
+                 "  \"generation\": %u,\n", (long) snapshot->taken,
+            (long) snapshot->created, snapshot->generation);
+    fprintf(out, "  \"tracing\": %s,\n", JSONBOOL(config->tracing));
+    fprintf(out, "  \"sample\": {\"policy\": \"%s\", \"every\": %lu, "
+                 "\"probability\": %g, \"rate\": %lu, \"count\": %lu},\n",
+            __sample_policy(&(config->sample)), config->sample.every,
+            config->sample.probability, config->sample.rate, 
+            snapshot->samplecount);
+    fprintf(out, "  \"window\": {\"bounded\": %s, \"seconds_left\": %lu, "
+                 "\"runs_left\": %lu, \"wraps_all\": %s},\n", 
+            JSONBOOL(config->windowid != 0), snapshot->windowseconds, 
+            snapshot->windowruns, JSONBOOL(config->windowall == 1));
+    fprintf(out, "  \"arm\": {\"armed\": %s, \"on_failure\": %s, "
+                 "\"slower_than_us\": %lu, \"runs\": %lu, "
+                 "\"cooldown_seconds\": %lu, \"triggers\": %lu},\n",
+            JSONBOOL(snapshot->arm.armed), JSONBOOL(snapshot->arm.onfailure),
+            snapshot->arm.slowerthan, snapshot->arm.runs, 
+            snapshot->arm.cooldown, counters->triggers);
+    fprintf(out, "  \"wrapper\": ");
+    __json_string(out, config->wrapper);
+    fprintf(out, ",\n  \"outdir\": ");
+    __json_string(out, config->outdir);
+    fprintf(out, ",\n  \"record\": {\"bytes\": %lu, \"slower_than_us\": %lu, "
+                 "\"kept\": %lu}", config->recordbytes, config->recordslower,
+            counters->recorded);
+    fprintf(out, ",\n  \"keep\": %lu,\n  \"compress\": %s,\n"
+                 "  \"max_concurrent\": %lu,\n  \"max_bytes\": %lu,\n",
+            config->keep - 1, JSONBOOL(config->compress), 
+            config->maxconcurrent, config->maxbytes);
+    fprintf(out, "  \"executions\": {\"wrapped\": %lu, \"unwrapped\": %lu, "
+                 "\"sampled_out\": %lu, \"demoted\": %lu},\n",
+            counters->wrappedexecutions, counters->unwrappedexecutions,
+            counters->sampledout, counters->demoted);
+    fprintf(out, "  \"in_flight\": %lu,\n  \"in_flight_peak\": %lu,\n"
+                 "  \"begins\": %lu,\n  \"ends\": %lu,\n"
+                 "  \"retained_bytes\": %lu,\n  \"lock_recoveries\": %lu,\n",
+            counters->inflight, counters->inflightpeak, counters->begins,
+            counters->ends, counters->totalbytes, counters->lockrecoveries);
+    fprintf(out, "  \"eviction\": {\"worker\": %d, \"queued\": %lu, "
+                 "\"evicting\": %lu, \"evicted\": %lu, \"failures\": %lu, "
+                 "\"quota_overruns\": %lu, "
+                 "\"recycle\": %s, \"spares\": %lu, \"recycled\": %lu},\n",
+            evictstats->evictworker, evictstats->evictcount, 
+            evictstats->evicting, evictstats->evicted, 
+            evictstats->evictfailures, evictstats->quotaoverruns,
+            JSONBOOL(config->recycle),
+            evictstats->sparecount, evictstats->recycled);
+    fprintf(out, "  \"event_watcher\": %d,\n", snapshot->eventwatcher);
+    fprintf(out, "  \"latency_us\": {\n    \"wrapped\": ");
+    __json_latency(out, &(snapshot->wrappedlatency));
+    fprintf(out, ",\n    \"unwrapped\": ");
+    __json_latency(out, &(snapshot->unwrappedlatency));
+    fprintf(out, "\n  },\n");
+    fprintf(out, "  \"usage\": {\n    \"wrapped\": ");
+    __json_usage(out, &(snapshot->wrappedusage));
+    fprintf(out, ",\n    \"unwrapped\": ");
+    __json_usage(out, &(snapshot->unwrappedusage));
+    fprintf(out, "\n  },\n");
+    /* averages since --init, rates over shorter spans need two scrapes */
+    fprintf(out, "  \"rates\": {\"uptime_seconds\": %.0f, "
+                 "\"executions_per_second\": %g, "
+                 "\"wrapped_per_second\": %g, "
+                 "\"unwrapped_per_second\": %g, \"wrapped_ratio\": %g},\n",
+            __uptime(snapshot), executions / __uptime(snapshot),
+            counters->wrappedexecutions / __uptime(snapshot),
+            counters->unwrappedexecutions / __uptime(snapshot),
+            (executions > 0) ? 
+            (double) counters->wrappedexecutions / executions : 0.0);
+    fprintf(out, "  \"logring\": [");
+    for (; counter < snapshot->logged; counter++) {
+        fprintf(out, "%s\n    {\"path\": ", (counter > 0) ? "," : "");
+        __json_string(out, snapshot->logring[counter].path);
+        fprintf(out, ", \"bytes\": %lu, \"arena_sequence\": %lu}", 
+                snapshot->logring[counter].bytes,
+                snapshot->logring[counter].arenaseq);
+    }
+    fprintf(out, "%s]\n}\n", (snapshot->logged > 0) ? "\n  " : "");
+}
+
+void export_prometheus(FILE *out, const char const *name,
+                       const char const *command, 
+                       const snapshot_t *snapshot) {
+    const counters_t *counters = &(snapshot->counters);
+    const config_t *config = &(snapshot->config);
+    const evictstats_t *evictstats = &(snapshot->evictstats);
+    unsigned long counter=0;
+    unsigned long largest=0;
+    char metric[64];
+
+    __prom_header(out, "info", "gauge", "Ring configuration, always 1.");
+    fprintf(out, EXPORT_PREFIX"info{ring=");
+    __prom_label(out, name);
+    fprintf(out, ",command=");
+    __prom_label(out, command);
+    fprintf(out, ",wrapper=");
+    __prom_label(out, config->wrapper);
+    fprintf(out, ",outdir=");
+    __prom_label(out, config->outdir);
+    fprintf(out, ",sample=\"%s\"} 1\n", __sample_policy(&(config->sample)));
+    __prom_header(out, "tracing", "gauge", "1 while wrapping is on.");
+    __prom_sample(out, "tracing", name, NULL, NULL, config->tracing);
+    __prom_header(out, "window_seconds_left", "gauge", 
+                  "Seconds until wrapping ends by itself, 0 for unbounded.");
+    __prom_sample(out, "window_seconds_left", name, NULL, NULL, 
+                  snapshot->windowseconds);
+    __prom_header(out, "window_runs_left", "gauge", 
+                  "Wrapped executions until wrapping ends by itself, "
+                  "0 for unbounded.");
+    __prom_sample(out, "window_runs_left", name, NULL, NULL, 
+                  snapshot->windowruns);
+    __prom_header(out, "record_bytes", "gauge", 
+                  "Flight recorder size per unwrapped execution, 0 if off.");
+    __prom_sample(out, "record_bytes", name, NULL, NULL, config->recordbytes);
+    __prom_header(out, "recordings_kept_total", "counter", 
+                  "Flight recordings of failed or slow executions kept.");
+    __prom_sample(out, "recordings_kept_total", name, NULL, NULL, 
+                  counters->recorded);
+    __prom_header(out, "armed", "gauge", 
+                  "1 while anomalies switch wrapping on by themselves.");
+    __prom_sample(out, "armed", name, NULL, NULL, snapshot->arm.armed);
+    __prom_header(out, "anomaly_triggers_total", "counter", 
+                  "Times an anomaly switched wrapping on.");
+    __prom_sample(out, "anomaly_triggers_total", name, NULL, NULL, 
+                  counters->triggers);
+    __prom_header(out, "created_seconds", "gauge", 
+                  "Unix time the ring was initialized.");
+    __prom_sample(out, "created_seconds", name, NULL, NULL, 
+                  snapshot->created);
+    __prom_header(out, "executions_total", "counter", 
+                  "Executions, by whether they were wrapped.");
+    __prom_sample(out, "executions_total", name, "wrapped", "1",
+                  counters->wrappedexecutions);
+    __prom_sample(out, "executions_total", name, "wrapped", "0",
+                  counters->unwrappedexecutions);
+    __prom_header(out, "executions_per_second", "gauge", 
+                  "Average executions per second since initialized.");
+    __prom_sample(out, "executions_per_second", name, NULL, NULL, 
+                  (counters->wrappedexecutions + 
+                   counters->unwrappedexecutions) / __uptime(snapshot));
+    __prom_header(out, "sampled_out_total", "counter", 
+                  "Executions not wrapped due to sampling policy.");
+    __prom_sample(out, "sampled_out_total", name, NULL, NULL, 
+                  counters->sampledout);
+    __prom_header(out, "demoted_total", "counter", 
+                  "Executions not wrapped due to max concurrent or arena.");
+    __prom_sample(out, "demoted_total", name, NULL, NULL, counters->demoted);
+    __prom_header(out, "max_concurrent", "gauge", 
+                  "Cap on concurrently wrapped executions, 0 for none.");
+    __prom_sample(out, "max_concurrent", name, NULL, NULL, 
+                  config->maxconcurrent);
+    __prom_header(out, "in_flight", "gauge", 
+                  "Wrapped executions running now.");
+    __prom_sample(out, "in_flight", name, NULL, NULL, counters->inflight);
+    __prom_header(out, "in_flight_peak", "gauge", 
+                  "Most wrapped executions ever running at once.");
+    __prom_sample(out, "in_flight_peak", name, NULL, NULL, 
+                  counters->inflightpeak);
+    __prom_header(out, "begins_total", "counter", "Times wrapping began.");
+    __prom_sample(out, "begins_total", name, NULL, NULL, counters->begins);
+    __prom_header(out, "ends_total", "counter", "Times wrapping ended.");
+    __prom_sample(out, "ends_total", name, NULL, NULL, counters->ends);
+    __prom_header(out, "keep", "gauge", "Output directories retained.");
+    __prom_sample(out, "keep", name, NULL, NULL, config->keep - 1);
+    __prom_header(out, "logged", "gauge", "Entries in the logring.");
+    __prom_sample(out, "logged", name, NULL, NULL, snapshot->logged);
+    __prom_header(out, "retained_bytes", "gauge", 
+                  "Bytes of all logring entries.");
+    __prom_sample(out, "retained_bytes", name, NULL, NULL, 
+                  counters->totalbytes);
+    __prom_header(out, "max_bytes", "gauge", 
+                  "Quota on retained bytes, 0 for none.");
+    __prom_sample(out, "max_bytes", name, NULL, NULL, config->maxbytes);
+    __prom_header(out, "evicted_total", "counter", 
+                  "Output directories removed by eviction worker.");
+    __prom_sample(out, "evicted_total", name, NULL, NULL, 
+                  evictstats->evicted);
+    __prom_header(out, "eviction_failures_total", "counter", 
+                  "Output directories eviction worker failed to remove.");
+    __prom_sample(out, "eviction_failures_total", name, NULL, NULL, 
+                  evictstats->evictfailures);
+    __prom_header(out, "quota_overruns_total", "counter", 
+                  "Executions leaving retained bytes over max_bytes, "
+                  "the eviction queue being full.");
+    __prom_sample(out, "quota_overruns_total", name, NULL, NULL, 
+                  evictstats->quotaoverruns);
+    __prom_header(out, "eviction_backlog", "gauge", 
+                  "Output directories waiting to be removed.");
+    __prom_sample(out, "eviction_backlog", name, NULL, NULL, 
+                  evictstats->evictcount + evictstats->evicting);
+    __prom_header(out, "spare_directories", "gauge", 
+                  "Emptied output directories waiting to be reused.");
+    __prom_sample(out, "spare_directories", name, NULL, NULL, 
+                  evictstats->sparecount);
+    __prom_header(out, "recycled_total", "counter", 
+                  "Output directories reused instead of created.");
+    __prom_sample(out, "recycled_total", name, NULL, NULL, 
+                  evictstats->recycled);
+    __prom_header(out, "lock_recoveries_total", "counter", 
+                  "Times the lock was taken over from a dead holder.");
+    __prom_sample(out, "lock_recoveries_total", name, NULL, NULL, 
+                  counters->lockrecoveries);
+    __prom_header(out, "latency_microseconds", "summary", 
+                  "Execution latency, by whether it was wrapped.");
+    __prom_latency(out, name, "1", &(snapshot->wrappedlatency));
+    __prom_latency(out, name, "0", &(snapshot->unwrappedlatency));
+    /* HELP/TYPE once per family, as exposition format requires */
+    __prom_header(out, "usage_runs_total", "counter", 
+                  "Executions whose resource usage was accounted.");
+    __prom_sample(out, "usage_runs_total", name, "wrapped", "1",
+                  snapshot->wrappedusage.runs);
+    __prom_sample(out, "usage_runs_total", name, "wrapped", "0",
+                  snapshot->unwrappedusage.runs);
+    for (counter = 0; counter < USAGE_FIELDS; counter++) {
+        snprintf(metric, sizeof(metric), "usage_%s_total", 
+                 __usagenames[counter]);
+        __prom_header(out, metric, "counter", 
+                      "Sum over executions, as reaped by wait4().");
+        __prom_sample(out, metric, name, "wrapped", "1",
+                      snapshot->wrappedusage.total[counter]);
+        __prom_sample(out, metric, name, "wrapped", "0",
+                      snapshot->unwrappedusage.total[counter]);
+        snprintf(metric, sizeof(metric), "usage_%s_max", 
+                 __usagenames[counter]);
+        __prom_header(out, metric, "gauge", 
+                      "Highest of any one execution.");
+        __prom_sample(out, metric, name, "wrapped", "1",
+                      snapshot->wrappedusage.max[counter]);
+        __prom_sample(out, metric, name, "wrapped", "0",
+                      snapshot->unwrappedusage.max[counter]);
+    }
+    /* a series per run path would grow without bound, JSON has those */
+    for (counter = 0; counter < snapshot->logged; counter++)
+        if (snapshot->logring[counter].bytes > largest)
+            largest = snapshot->logring[counter].bytes;
+    __prom_header(out, "logring_entry_max_bytes", "gauge", 
+                  "Bytes of the largest retained output directory.");
+    __prom_sample(out, "logring_entry_max_bytes", name, NULL, NULL, largest);
+    __prom_header(out, "logring_newest_bytes", "gauge", 
+                  "Bytes of the most recent retained output directory.");
+    __prom_sample(out, "logring_newest_bytes", name, NULL, NULL, 
+                  (snapshot->logged > 0) ? 
+                  snapshot->logring[snapshot->logged - 1].bytes : 0);
+}
+
+int export_stats(shared_t *shared, const char const *command,
+                 exportformat_t format, const char const *path) {
+    snapshot_t snapshot;
+    FILE *out=stdout;
+    char *tmppath=NULL;
+    char pidstr[32];
+    int result=0;
+
+    if (path != NULL) {
+        /* unique per process and not *.prom, so collectors skip it */
+        snprintf(pidstr, sizeof(pidstr), ".%d"EXPORT_TMPSUFFIX, getpid());
+        tmppath = utility_strcat(path, pidstr);
+        if ((tmppath == NULL) || ((out = fopen(tmppath, "w")) == NULL)) {
+            fprintf(stderr, "ERROR: Create %s: %s\n", 
+                    (tmppath != NULL) ? tmppath : path, strerror(errno));
+            free(tmppath);
+            return 1;
+        }
+    }
+    export_snapshot(shared, &snapshot);
+    if (format == EXPORT_PROMETHEUS)
+        export_prometheus(out, shared->name, command, &snapshot);
+    else
+        export_json(out, shared->name, command, &snapshot);
+    export_free(&snapshot);
+    if (path == NULL)
+        return (fflush(out) != 0);
+    if ((fflush(out) != 0) || (fsync(fileno(out)) != 0))
+        result = 1;
+    if (fclose(out) != 0)
+        result = 1;
+    if ((result == 0) && (rename(tmppath, path) != 0))
+        result = 1;
+    if (result != 0) {
+        fprintf(stderr, "ERROR: Write %s: %s\n", path, strerror(errno));
+        unlink(tmppath);
+    }
+    free(tmppath);
+    return result;
+}
@@ -0,0 +1,98 @@
+/*
+#
+# Copyright (C) 2010 by Chris Evich <cevich@redhat.com>
+#
+#   This library is free software; you can redistribute it and/or
+#   modify it under the terms of the GNU Lesser General Public
+#   License as published by the Free Software Foundation; either
+#   version 2.1 of the License, or (at your option) any later version.
+#
+#   This library is distributed in the hope that it will be useful,
+#   but WITHOUT ANY WARRANTY; without even the implied warranty of
+#   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+#   Lesser General Public License for more details.
+#
+#   You should have received a copy of the GNU Lesser General Public
+#   License along with this library; if not, write to the Free Software
+#   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+#
+*/
+
+#ifndef _EXPORT_H
+#define _EXPORT_H
+
+/* users of this need: 
+    #include <stdio.h>
+    #include <semaphore.h>
+    #include <pthread.h>
+    #include <time.h>
+    #include "histogram.h"
+    #include "registry.h"
+    #include "ring.h"
+*/
+
+/**************************************************
+********************* MACROS
+**************************************************/
+#define EXPORT_PREFIX PROGNAM"_" /* of every prometheus metric name */
+#define EXPORT_TMPSUFFIX ".tmp" /* of file written before rename() */
+
+/**************************************************
+********************* TYPES
+**************************************************/
+
+typedef enum exportformat_e {
+    EXPORT_TEXT, /* print_stats() prose */
+    EXPORT_JSON, /* one JSON object */
+    EXPORT_PROMETHEUS, /* prometheus text exposition format */
+} exportformat_t;
+
+/* Everything exported, copied from shared without locking */
+typedef struct snapshot_s {
+    time_t taken; /* when the copy was made */
+    time_t created; /* when shared was initialized */
+    unsigned int generation;
+    pid_t eventwatcher;
+    unsigned long samplecount;
+    unsigned long windowseconds; /* left in tracing window or 0 */
+    unsigned long windowruns; /* left in tracing window or 0 */
+    config_t config;
+    counters_t counters;
+    evictstats_t evictstats;
+    histogram_t wrappedlatency;
+    histogram_t unwrappedlatency;
+    arm_t arm;
+    usage_t wrappedusage;
+    usage_t unwrappedusage;
+    unsigned long logged; /* entries in logring */
+    logentry_t *logring; /* oldest first, allocated */
+} snapshot_t;
+
+/**************************************************
+********************* FUNCTION DEFINITIONS
+**************************************************/
+
+/* fills snapshot from shared. Requires no locking.  Free with 
+   export_free() */
+void export_snapshot(shared_t *shared, snapshot_t *snapshot);
+
+/* frees memory allocated by export_snapshot() */
+void export_free(snapshot_t *snapshot);
+
+/* writes snapshot of ring name, wrapping command, to out as JSON */
+void export_json(FILE *out, const char const *name, 
+                 const char const *command, const snapshot_t *snapshot);
+
+/* writes snapshot of ring name, wrapping command, to out in prometheus
+   text format */
+void export_prometheus(FILE *out, const char const *name,
+                       const char const *command, 
+                       const snapshot_t *snapshot);
+
+/* writes snapshot of shared in format to stdout, or if path isn't NULL,
+   to a temporary file renamed over path once complete, so readers never
+   see it partly written.  Returns 0 on success, non-zero on failure */
+int export_stats(shared_t *shared, const char const *command,
+                 exportformat_t format, const char const *path);
+
+#endif /* _EXPORT_H */
@@ -0,0 +1,129 @@
+/*
+#
+# Copyright (C) 2010 by Chris Evich <cevich@redhat.com>
+#
+#   This library is free software; you can redistribute it and/or
+#   modify it under the terms of the GNU Lesser General Public
+#   License as published by the Free Software Foundation; either
+#   version 2.1 of the License, or (at your option) any later version.
+#
+#   This library is distributed in the hope that it will be useful,
+#   but WITHOUT ANY WARRANTY; without even the implied warranty of
+#   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+#   Lesser General Public License for more details.
+#
+#   You should have received a copy of the GNU Lesser General Public
+#   License along with this library; if not, write to the Free Software
+#   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+#
+*/
+
+#include <string.h>
+#include "histogram.h"
+
+/**************************************************
+********************* PRIVATE FUNCTION DEFINITIONS
+**************************************************/
+
+/* returns bucket index value is counted in */
+static size_t __histogram_index(unsigned long value);
+
+/* returns highest value counted in bucket index */
+static unsigned long __histogram_highest(size_t index);
+
+/**************************************************
+********************* PRIVATE FUNCTIONS
+**************************************************/
+
+static size_t __histogram_index(unsigned long value) {
+    int shift=0;
+    size_t index=0;
+
+    if (value < HISTOGRAM_SUBBUCKETS)
+        return value; /* exact */
+    /* how far value must shift so it lands in [SUBBUCKETS, 2*SUBBUCKETS) */
+    shift = ((sizeof(unsigned long) * 8) - 1 - __builtin_clzl(value)) -
+            HISTOGRAM_SUBBITS;
+    index = ((shift + 1) * HISTOGRAM_SUBBUCKETS) +
+            ((value >> shift) - HISTOGRAM_SUBBUCKETS);
+    if (index >= HISTOGRAM_BUCKETS)
+        return HISTOGRAM_BUCKETS - 1;
+    return index;
+}
+
+static unsigned long __histogram_highest(size_t index) {
+    int shift=0;
+    unsigned long sub=0;
+
+    if (index < HISTOGRAM_SUBBUCKETS)
+        return index; /* exact */
+    shift = (index / HISTOGRAM_SUBBUCKETS) - 1;
+    sub = (index % HISTOGRAM_SUBBUCKETS) + HISTOGRAM_SUBBUCKETS;
+    return ((sub + 1) << shift) - 1;
+}
+
+/**************************************************
+********************* FUNCTIONS
+**************************************************/
+
+void histogram_record(histogram_t *histogram, unsigned long value) {
+    unsigned long max=0;
+
+    __atomic_fetch_add(&(histogram->buckets[__histogram_index(value)]), 1,
+                       __ATOMIC_RELAXED);
+    __atomic_fetch_add(&(histogram->sum), value, __ATOMIC_RELAXED);
+    max = __atomic_load_n(&(histogram->max), __ATOMIC_RELAXED);
+    while ((value > max) &&
+           (__atomic_compare_exchange_n(&(histogram->max), &max, value, 0,
+                                        __ATOMIC_RELAXED,
+                                        __ATOMIC_RELAXED) == 0))
+        continue; /* max was reloaded by failed exchange */
+    /* count last, so readers never see more counted than bucketed */
+    __atomic_fetch_add(&(histogram->count), 1, __ATOMIC_RELEASE);
+}
+
+void histogram_copy(histogram_t *histogram, histogram_t *copy) {
+    size_t index=0;
+
+    memset(copy, 0, sizeof(histogram_t));
+    copy->count = __atomic_load_n(&(histogram->count), __ATOMIC_ACQUIRE);
+    copy->sum = __atomic_load_n(&(histogram->sum), __ATOMIC_RELAXED);
+    copy->max = __atomic_load_n(&(histogram->max), __ATOMIC_RELAXED);
+    for (; index < HISTOGRAM_BUCKETS; index++)
+        copy->buckets[index] = __atomic_load_n(&(histogram->buckets[index]),
+                                               __ATOMIC_RELAXED);
+}
+
+unsigned long histogram_mean(const histogram_t *histogram) {
+    if (histogram->count == 0)
+        return 0;
+    return histogram->sum / histogram->count;
+}
+
+unsigned long histogram_percentile(const histogram_t *histogram,
+                                   double percentile) {
+    unsigned long target=0;
+    unsigned long seen=0;
+    unsigned long highest=0;
+    size_t index=0;
+
+    if (histogram->count == 0)
+        return 0;
+    /* rank of the value wanted, rounded up, at least the first */
+    target = (unsigned long) ((percentile / 100.0) * histogram->count);
+    if (((double) target) < ((percentile / 100.0) * histogram->count))
+        target++;
+    if (target == 0)
+        target = 1;
+    for (; index < HISTOGRAM_BUCKETS; index++) {
+        seen += histogram->buckets[index];
+        if (seen >= target)
+            break;
+    }
+    if (index >= HISTOGRAM_BUCKETS)
+        return histogram->max; /* copy raced with recording */
+    highest = __histogram_highest(index);
+    if (highest > histogram->max)
+        return histogram->max; /* never report beyond what was seen */
+    return highest;
+}
@@ -0,0 +1,65 @@
+/*
+#
+# Copyright (C) 2010 by Chris Evich <cevich@redhat.com>
+#
+#   This library is free software; you can redistribute it and/or
+#   modify it under the terms of the GNU Lesser General Public
+#   License as published by the Free Software Foundation; either
+#   version 2.1 of the License, or (at your option) any later version.
+#
+#   This library is distributed in the hope that it will be useful,
+#   but WITHOUT ANY WARRANTY; without even the implied warranty of
+#   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+#   Lesser General Public License for more details.
+#
+#   You should have received a copy of the GNU Lesser General Public
+#   License along with this library; if not, write to the Free Software
+#   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+#
+*/
+
+#ifndef _HISTOGRAM_H
+#define _HISTOGRAM_H
+
+/**************************************************
+********************* MACROS
+**************************************************/
+#define HISTOGRAM_SUBBITS 4 /* log2 of HISTOGRAM_SUBBUCKETS */
+#define HISTOGRAM_SUBBUCKETS (1 << HISTOGRAM_SUBBITS) /* linear buckets
+                                                         per power of two */
+#define HISTOGRAM_MAGNITUDES 40 /* powers of two covered, beyond is clamped */
+#define HISTOGRAM_BUCKETS (HISTOGRAM_MAGNITUDES * HISTOGRAM_SUBBUCKETS)
+
+/**************************************************
+********************* TYPES
+**************************************************/
+
+/* Log bucketed (HDR style) histogram, values within a bucket differ by at 
+   most 1/HISTOGRAM_SUBBUCKETS.  Safe to place in shared memory, all 
+   updates are atomic so it needs no locking. */
+typedef struct histogram_s {
+    unsigned long count; /* number of values recorded */
+    unsigned long sum; /* of all values recorded, for mean */
+    unsigned long max; /* largest value recorded */
+    unsigned long buckets[HISTOGRAM_BUCKETS];
+} histogram_t;
+
+/**************************************************
+********************* FUNCTION DEFINITIONS
+**************************************************/
+
+/* atomically add value to histogram. Requires no locking. */
+void histogram_record(histogram_t *histogram, unsigned long value);
+
+/* copy histogram into copy with atomic reads. Requires no locking. */
+void histogram_copy(histogram_t *histogram, histogram_t *copy);
+
+/* returns mean of values recorded in histogram or 0 if empty */
+unsigned long histogram_mean(const histogram_t *histogram);
+
+/* returns highest value equivalent to percentile (0-100) of values
+   recorded in histogram, or 0 if empty */
+unsigned long histogram_percentile(const histogram_t *histogram,
+                                   double percentile);
+
+#endif /* _HISTOGRAM_H */
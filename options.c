@@ -18,15 +18,24 @@
 #
 */
 
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <argp.h>
 #include <sys/types.h>
 #include <sys/mman.h>
+#include <sys/resource.h>
 #include <semaphore.h>
+#include <pthread.h>
+#include <time.h>
 #include "version.h"
+#include "compress.h"
+#include "recorder.h"
 #include "options.h"
+#include "histogram.h"
+#include "registry.h"
 #include "ring.h"
+#include "export.h"
 #include "ringwrap.h"
 #include "utility.h"
 
@@ -36,6 +45,9 @@
 options_t *options = NULL;
 static void __options_new(void);
 static error_t __parser(int key, char *arg, struct argp_state *state);
+/* returns 1 if wrapper has strace's -ff, writing a file per process
+   named after "@@@" instead of "@@@" itself, else 0 */
+static int __wrapper_ff(const char const *wrapper);
 const char *argp_program_version = PROGVER_s;
 const char *argp_program_bug_address = PROGAUTHOR;
 static struct argp __argp = { 
@@ -55,13 +67,32 @@ static struct argp __argp = {
 **************************************************/
 static void __options_new(void) {
     options = malloc(sizeof(options_t));
-    memset(options, 0, sizeof(options));
+    memset(options, 0, sizeof(options_t));
     options->mode = DEFAULT_MODE;
     options->command = DEFAULT_COMMAND;
     options->keep = DEFAULT_KEEP + 1;
     options->outdir = utility_fixpath(DEFAULT_OUTDIR);
     options->wrapper = utility_strcpy(DEFAULT_WRAPPER);
     options->unique = utility_strcpy(DEFAULT_UNIQUE);
+    options->maxconcurrent = -1;
+    options->maxbytes = -1;
+    options->cooldown = DEFAULT_COOLDOWN;
+}
+
+static int __wrapper_ff(const char const *wrapper) {
+    char **words=NULL;
+    char **word=NULL;
+    int result=0;
+
+    words = utility_argvsplit(wrapper);
+    if (words == NULL)
+        return 0; /* complained about when executing */
+    /* short options combine, e.g. -fft */
+    for (word = words; (result == 0) && (*word != NULL); word++)
+        result = (((*word)[0] == '-') && ((*word)[1] != '-') &&
+                  (strstr(*word, "ff") != NULL));
+    utility_argvcfree(words);
+    return result;
 }
 
 void multimode(void) {
@@ -71,6 +102,8 @@ void multimode(void) {
 
 static error_t __parser(int key, char *arg, struct argp_state *state) {
     options_t *options = (options_t *) state->input;
+    long seconds=0;
+    long size=0;
 
     switch (key) {
         case 's':
@@ -122,6 +155,161 @@ static error_t __parser(int key, char *arg, struct argp_state *state) {
                 multimode();
             options->mode = MODE_FINI;
             break;
+        case 'n':
+            options->noshell = 1;
+            break;
+        case 'x':
+            options->exec = 1;
+            break;
+        case 'z':
+            options->compress = 1;
+            break;
+        case 'r':
+            options->registry = 1;
+            break;
+        case 'l':
+            if (options->mode != MODE_BEGINMODES)
+                multimode();
+            options->mode = MODE_LIST;
+            options->registry = 1;
+            break;
+        case OPTKEY_WATCH:
+            if (options->mode != MODE_BEGINMODES)
+                multimode();
+            options->mode = MODE_WATCH;
+            break;
+        case OPTKEY_EVERY:
+            options->every = strtoul(arg,NULL,0);
+            if (options->every < 1)
+                argp_error(state, "--every must be at least 1");
+            break;
+        case OPTKEY_PROBABILITY:
+            options->probability = strtod(arg,NULL);
+            if ((options->probability <= 0.0) || (options->probability > 1.0))
+                argp_error(state, "--probability must be over 0.0 up to 1.0");
+            break;
+        case OPTKEY_RATE:
+            options->rate = strtoul(arg,NULL,0);
+            if (options->rate < 1)
+                argp_error(state, "--rate must be at least 1");
+            break;
+        case OPTKEY_FOR:
+            seconds = utility_strtoduration(arg);
+            if (seconds < 1)
+                argp_error(state, "--for must be a duration like "
+                                  "30, 30s, 5m, 2h or 1d");
+            options->forseconds = seconds;
+            break;
+        case OPTKEY_RUNS:
+            options->runs = strtoul(arg,NULL,0);
+            if (options->runs < 1)
+                argp_error(state, "--runs must be at least 1");
+            break;
+        case OPTKEY_ARENA:
+            size = utility_strtosize(arg);
+            if (size < 1)
+                argp_error(state, "--arena must be a size like 65536, 512K "
+                                  "or 1M");
+            options->arena = size;
+            break;
+        case OPTKEY_RECYCLE:
+            options->recycle = 1;
+            break;
+        case OPTKEY_EXTRACT:
+            if (options->mode != MODE_BEGINMODES)
+                multimode();
+            options->mode = MODE_EXTRACT;
+            free(options->extract);
+            options->extract = utility_strcpy(arg);
+            break;
+        case OPTKEY_RECORD:
+            size = utility_strtosize(arg);
+            if ((size < 1) || (size > RECORD_MAXLEN))
+                argp_error(state, "--record must be a size like 4096, 64K "
+                                  "or 1M, at most %dM", 
+                           RECORD_MAXLEN / (1024 * 1024));
+            options->record = size;
+            break;
+        case OPTKEY_RECORDSLOWER:
+            options->recordslower = strtoul(arg,NULL,0);
+            if (options->recordslower < 1)
+                argp_error(state, "--record-slower-than must be at least 1");
+            break;
+        case OPTKEY_ARM:
+            if (options->mode != MODE_BEGINMODES)
+                multimode();
+            options->mode = MODE_ARM;
+            break;
+        case OPTKEY_DISARM:
+            if (options->mode != MODE_BEGINMODES)
+                multimode();
+            options->mode = MODE_DISARM;
+            break;
+        case OPTKEY_ONFAILURE:
+            options->onfailure = 1;
+            break;
+        case OPTKEY_SLOWERTHAN:
+            options->slowerthan = strtoul(arg,NULL,0);
+            if (options->slowerthan < 1)
+                argp_error(state, "--slower-than must be at least 1");
+            break;
+        case OPTKEY_COOLDOWN:
+            seconds = utility_strtoduration(arg);
+            if (seconds < 0)
+                argp_error(state, "--cooldown must be a duration like "
+                                  "0, 30s, 5m, 2h or 1d");
+            options->cooldown = seconds;
+            break;
+        case OPTKEY_MAXCONCURRENT:
+            options->maxconcurrent = strtol(arg,NULL,0);
+            if ((options->maxconcurrent < 0) || 
+                (options->maxconcurrent > MAXINFLIGHT))
+                argp_error(state, "--max-concurrent must be 0 - %d",
+                           MAXINFLIGHT);
+            break;
+        case OPTKEY_MAXBYTES:
+            options->maxbytes = utility_strtosize(arg);
+            if (options->maxbytes < 0)
+                argp_error(state, "--max-bytes must be a size like "
+                                  "1048576, 512K, 100M or 2G");
+            break;
+        case OPTKEY_FORMAT:
+            if (strcmp(arg, "json") == 0)
+                options->format = EXPORT_JSON;
+            else if (strcmp(arg, "prometheus") == 0)
+                options->format = EXPORT_PROMETHEUS;
+            else
+                argp_error(state, "--format must be json or prometheus");
+            break;
+        case OPTKEY_OUTPUT:
+            free(options->output);
+            options->output = utility_strcpy(arg);
+            break;
+        case ARGP_KEY_SUCCESS: /* all options parsed */
+            options->wrapperff = __wrapper_ff(options->wrapper);
+            if ( ((options->every > 0) + (options->probability > 0.0) +
+                  (options->rate > 0)) > 1 )
+                argp_error(state, "Only one of --every, --probability or "
+                                  "--rate may be used");
+            if ((options->mode == MODE_ARM) && (options->onfailure == 0) &&
+                (options->slowerthan == 0))
+                argp_error(state, "--arm needs --on-failure and/or "
+                                  "--slower-than");
+            if ((options->arena > 0) && (options->compress == 1))
+                argp_error(state, "--arena can't be used with --compress");
+            if ((options->arena > 0) && (options->recycle == 1))
+                argp_error(state, "--arena can't be used with --recycle");
+            if ((options->arena > 0) && (options->wrapperff == 1))
+                argp_error(state, "--arena needs a wrapper writing only "
+                                  "\""MAGIC"\", e.g. -w \"strace -f -o "
+                                  MAGIC"\"");
+            if ((options->exec == 1) && (options->record > 0))
+                argp_error(state, "--exec leaves no process behind to "
+                                  "--record the command");
+            if ((options->output != NULL) && 
+                (options->format == EXPORT_TEXT))
+                argp_error(state, "--output requires --format");
+            break;
         default:
             return ARGP_ERR_UNKNOWN;
     }
@@ -135,7 +323,10 @@ void options_fini(void) {
     free(options->outdir);
     free(options->wrapper);
     free(options->unique);
-    memset(options, 0, sizeof(options));
+    free(options->output);
+    free(options->extract);
+    utility_argvcfree(options->cmdargv);
+    memset(options, 0, sizeof(options_t));
     free(options);
     options = NULL;
 }
@@ -184,6 +375,14 @@ options_t *options_get(int argc, const char const * const *argv) {
         free(oldstr);
     }
     utility_argvcfree(argvc);
+    /* split once here, not every time the command is spawned */
+    if ((options->noshell == 1) && (options->command != NULL)) {
+        options->cmdargv = utility_argvsplit(options->command);
+        if ((options->cmdargv == NULL) || (options->cmdargv[0] == NULL)) {
+            options_showusage("Unbalanced quotes or empty command\n");
+            return NULL;
+        }
+    }
     return options;
 }
 
@@ -32,7 +32,12 @@ typedef enum mode_e {
     MODE_INIT, /* setup shared stuff or fail if already setup */
     MODE_BEGIN, /* Switch to executing trace command instead */
     MODE_END, /* Switch back to executing command normally */
-    MODE_FINI, /* tear down semaphore and shared memory */
+    MODE_FINI, /* tear down shared memory */
+    MODE_LIST, /* print out every ring in the registry */
+    MODE_WATCH, /* redraw stats whenever they change */
+    MODE_ARM, /* Switch tracing on by itself after an anomaly */
+    MODE_DISARM, /* Stop checking for anomalies */
+    MODE_EXTRACT, /* Materialize a run kept in the arena as files */
     MODE_ENDMODES /* check value, do not use */
 } mode_t;
 
@@ -43,9 +48,56 @@ typedef struct options_s {
     unsigned long keep; /* number of historical output dirs to preserve */
     char *outdir; /* base directory to use for strace -o option */
     char *wrapper; /* trace command and any parameters */
+    int wrapperff; /* 1 = wrapper writes per PID files, e.g. strace -ff */
     char *unique; /* uniquely identifying string */
+    int noshell; /* 1 = execute w/o /bin/sh, 0 = execute through /bin/sh -c */
+    int exec; /* 1 = unwrapped executions replace ringwrap via exec */
+    int compress; /* 1 = --init compresses wrapper output */
+    unsigned long record; /* --init flight recorder bytes or 0 */
+    unsigned long recordslower; /* --init keep recordings over ms or 0 */
+    unsigned long arena; /* --init arena bytes per run or 0 */
+    int recycle; /* 1 = --init reuses evicted run directories */
+    char *extract; /* --extract run */
+    int registry; /* 1 = shared data lives in the registry segment */
+    unsigned long every; /* --begin wrapping every Nth execution or 0 */
+    double probability; /* --begin wrapping with probability or 0.0 */
+    unsigned long rate; /* --begin wrapping at most N per second or 0 */
+    unsigned long forseconds; /* --begin wrapping for N seconds or 0 */
+    unsigned long runs; /* --begin or --arm wrapping N executions or 0 */
+    int onfailure; /* 1 = --arm triggers on failed executions */
+    unsigned long slowerthan; /* --arm triggers above milliseconds or 0 */
+    unsigned long cooldown; /* --arm seconds between triggers */
+    long maxconcurrent; /* cap on wrapped runs at once, 0 none, -1 unset */
+    long maxbytes; /* quota on retained output bytes, 0 none, -1 unset */
+    int format; /* exportformat_t of --stats output */
+    char *output; /* file --stats output replaces or NULL for stdout */
+    char **cmdargv; /* command split into words when noshell == 1 */
 } options_t;
 
+typedef enum optkey_e {
+    OPTKEY_BEGINKEYS = 256, /* Long only options, beyond any character */
+    OPTKEY_EVERY, /* --every */
+    OPTKEY_PROBABILITY, /* --probability */
+    OPTKEY_RATE, /* --rate */
+    OPTKEY_MAXCONCURRENT, /* --max-concurrent */
+    OPTKEY_MAXBYTES, /* --max-bytes */
+    OPTKEY_WATCH, /* --watch */
+    OPTKEY_FORMAT, /* --format */
+    OPTKEY_FOR, /* --for */
+    OPTKEY_RUNS, /* --runs */
+    OPTKEY_ARM, /* --arm */
+    OPTKEY_DISARM, /* --disarm */
+    OPTKEY_ONFAILURE, /* --on-failure */
+    OPTKEY_SLOWERTHAN, /* --slower-than */
+    OPTKEY_COOLDOWN, /* --cooldown */
+    OPTKEY_RECORD, /* --record */
+    OPTKEY_RECORDSLOWER, /* --record-slower-than */
+    OPTKEY_ARENA, /* --arena */
+    OPTKEY_EXTRACT, /* --extract */
+    OPTKEY_OUTPUT, /* --output */
+    OPTKEY_RECYCLE, /* --recycle */
+} optkey_t;
+
 /**************************************************
 ********************* MACROS
 **************************************************/
@@ -56,6 +108,8 @@ typedef struct options_s {
 #define DEFAULT_COMMAND NULL
 #define DEFAULT_WRAPPER "strace -f -ff -t -o @@@"
 #define DEFAULT_UNIQUE "X"
+#define DEFAULT_ARMRUNS 10 /* hard coded string in argp_options[] below */
+#define DEFAULT_COOLDOWN 60 /* seconds, likewise */
 
 /**************************************************
 ********************* GLOABALS
@@ -64,6 +118,11 @@ const static struct argp_option argp_options[] = {
     { "init",'i', NULL,0,"Initialize shared data.",1 },
     { "keep",'k',"number",0,"Number of output directories to retain", 1 },
     { "",0,NULL,OPTION_DOC,"Default: 10",1 },
+    { "max-bytes",OPTKEY_MAXBYTES,"size",0,
+                     "With --init or --begin, also retain fewer", 1 },
+    { "",0,NULL,OPTION_DOC,"output directories while they total more", 1 },
+    { "",0,NULL,OPTION_DOC,"than size bytes (K, M or G suffix allowed)", 1 },
+    { "",0,NULL,OPTION_DOC,"Default: 0 (no limit)", 1 },
     { "outdir", 'o', "path", 0, "Full path to output base directory", 2 },
     { "",0,NULL,OPTION_DOC,"Default: "DEFAULT_OUTDIR,2 },
     { "wrapper", 'w', "command", 0, "Wrapper command and arguments.", 3 },
@@ -72,12 +131,75 @@ const static struct argp_option argp_options[] = {
     { "",0,NULL,OPTION_DOC,
                      "<outdir>/YYYY-MM-DD_HH:MM:SS_PID-<PID>/<command>", 3 },
     { "",0,NULL,OPTION_DOC,"Default: \""DEFAULT_WRAPPER"\"", 3 },
+    { "compress",'z',NULL,0,"With --init, \""MAGIC"\" is replaced by a fifo", 3 },
+    { "",0,NULL,OPTION_DOC,"instead, it's contents are gzip'd into", 3 },
+    { "",0,NULL,OPTION_DOC,"<command>"COMPRESS_SUFFIX".  The wrapper must write", 3 },
+    { "",0,NULL,OPTION_DOC,"only that one file (e.g. no strace -ff)", 3 },
+    { "arena",OPTKEY_ARENA,"size",0,"With --init, \""MAGIC"\" is replaced by a pipe", 3 },
+    { "",0,NULL,OPTION_DOC,"into a size (e.g. 1M) segment of one file", 3 },
+    { "",0,NULL,OPTION_DOC,"preallocated in outdir, instead of a file in a", 3 },
+    { "",0,NULL,OPTION_DOC,"new directory per run.  The wrapper must", 3 },
+    { "",0,NULL,OPTION_DOC,"write only that (no strace -ff).  See --extract", 3 },
+    { "recycle",OPTKEY_RECYCLE,NULL,0,"With --init, empty evicted run directories", 3 },
+    { "",0,NULL,OPTION_DOC,"and rename them into place for new runs,", 3 },
+    { "",0,NULL,OPTION_DOC,"instead of removing them and making new ones", 3 },
+    { "record",OPTKEY_RECORD,"size",0,"With --init, capture stdout and stderr of", 3 },
+    { "",0,NULL,OPTION_DOC,"unwrapped executions in a size (e.g. 64K)", 3 },
+    { "",0,NULL,OPTION_DOC,"memory ring while passing them on, kept in a", 3 },
+    { "",0,NULL,OPTION_DOC,"run directory only if the command failed", 3 },
+    { "record-slower-than",OPTKEY_RECORDSLOWER,"ms",0,"With --record, also keep", 3 },
+    { "",0,NULL,OPTION_DOC,"recordings of runs taking over ms milliseconds", 3 },
     { "unique",'u',"string",0,"Keep multiple "PROGNAM"'s from conflicting.",4 },
     { "",0,NULL,OPTION_DOC,"on the same command with differing outdirs", 4 },
+    { "registry",'r',NULL,0,"Keep shared data in one segment shared by", 4 },
+    { "",0,NULL,OPTION_DOC,"all commands, instead of one per command", 4 },
     { "begin",'b',NULL,0,"Begin executing with wrapper command.",5 },
+    { "every",OPTKEY_EVERY,"N",0,"With --begin, only wrap every Nth execution",5 },
+    { "probability",OPTKEY_PROBABILITY,"P",0,
+                     "With --begin, only wrap executions with", 5 },
+    { "",0,NULL,OPTION_DOC,"probability P (0.0 - 1.0)", 5 },
+    { "rate",OPTKEY_RATE,"N",0,"With --begin, wrap at most N executions", 5 },
+    { "",0,NULL,OPTION_DOC,"per second", 5 },
+    { "for",OPTKEY_FOR,"duration",0,"With --begin, end wrapping by itself after", 5 },
+    { "",0,NULL,OPTION_DOC,"duration, e.g. 30s, 5m, 2h or 1d", 5 },
+    { "runs",OPTKEY_RUNS,"N",0,"With --begin, end wrapping by itself after", 5 },
+    { "",0,NULL,OPTION_DOC,"N wrapped executions.  With --arm, wrap N", 5 },
+    { "",0,NULL,OPTION_DOC,"executions per trigger, sampling all of them.", 5 },
+    { "",0,NULL,OPTION_DOC,"Default: 10", 5 },
+    { "max-concurrent",OPTKEY_MAXCONCURRENT,"N",0,
+                     "With --init or --begin, run executions", 5 },
+    { "",0,NULL,OPTION_DOC,"unwrapped while N wrapped ones are running", 5 },
+    { "",0,NULL,OPTION_DOC,"Default: 0 (no limit)", 5 },
     { "end",'e',NULL,0,"End executing with wrapper command.",5 },
+    { "arm",OPTKEY_ARM,NULL,0,"Begin wrapping by itself once an unwrapped", 5 },
+    { "",0,NULL,OPTION_DOC,"execution fails and/or is slow, see below", 5 },
+    { "on-failure",OPTKEY_ONFAILURE,NULL,0,"With --arm, trigger on any non-zero", 5 },
+    { "",0,NULL,OPTION_DOC,"exit code or killing signal", 5 },
+    { "slower-than",OPTKEY_SLOWERTHAN,"ms",0,"With --arm, trigger on executions", 5 },
+    { "",0,NULL,OPTION_DOC,"taking over ms milliseconds", 5 },
+    { "cooldown",OPTKEY_COOLDOWN,"duration",0,"With --arm, ignore anomalies for", 5 },
+    { "",0,NULL,OPTION_DOC,"duration after each trigger.  Default: 60s", 5 },
+    { "extract",OPTKEY_EXTRACT,"run",0,"Copy run (path, name or --stats index)", 5 },
+    { "",0,NULL,OPTION_DOC,"out of the --arena into it's directory", 5 },
+    { "disarm",OPTKEY_DISARM,NULL,0,"Stop --arm triggering, leaves wrapping", 5 },
+    { "",0,NULL,OPTION_DOC,"as it is", 5 },
     { "fini",'f',NULL,0,"Clean up shared data.",5 },
     { "stats", 's', NULL, 0, "Print statistics.",5},
+    { "format",OPTKEY_FORMAT,"json|prometheus",0,"With --stats, print every",5 },
+    { "",0,NULL,OPTION_DOC,"counter, histogram and logring entry in format", 5 },
+    { "output",OPTKEY_OUTPUT,"path",0,"With --stats --format, atomically replace", 5 },
+    { "",0,NULL,OPTION_DOC,"path instead of printing, e.g. for a textfile", 5 },
+    { "",0,NULL,OPTION_DOC,"collector.  Default: stdout", 5 },
+    { "list", 'l', NULL, 0, "Print every command in the registry.",5},
+    { "watch",OPTKEY_WATCH,NULL,0,"Show executions/sec, wrapping and newest",5},
+    { "",0,NULL,OPTION_DOC,"output, redrawn whenever they change", 5 },
+    { "noshell",'n',NULL,0,"Execute command and wrapper directly, not", 6 },
+    { "",0,NULL,OPTION_DOC,"through /bin/sh.  Only '', \"\" and \\ quoting", 6 },
+    { "",0,NULL,OPTION_DOC,"are understood, no pipes or redirection.", 6 },
+    { "exec",'x',NULL,0,"When not wrapping, exec the command in place", 6 },
+    { "",0,NULL,OPTION_DOC,"of "PROGNAM", keeping it's PID and file", 6 },
+    { "",0,NULL,OPTION_DOC,"descriptors.  It's latency isn't recorded,", 6 },
+    { "",0,NULL,OPTION_DOC,"nor it's output by --record.", 6 },
     { 0 }
 };
 
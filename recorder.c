@@ -0,0 +1,194 @@
+/*
+#
+# Copyright (C) 2010 by Chris Evich <cevich@redhat.com>
+#
+#   This library is free software; you can redistribute it and/or
+#   modify it under the terms of the GNU Lesser General Public
+#   License as published by the Free Software Foundation; either
+#   version 2.1 of the License, or (at your option) any later version.
+#
+#   This library is distributed in the hope that it will be useful,
+#   but WITHOUT ANY WARRANTY; without even the implied warranty of
+#   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+#   Lesser General Public License for more details.
+#
+#   You should have received a copy of the GNU Lesser General Public
+#   License along with this library; if not, write to the Free Software
+#   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+#
+*/
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include "recorder.h"
+
+/**************************************************
+********************* PRIVATE FUNCTION DEFINITIONS
+**************************************************/
+
+/* writes all of length bytes of data to fd, returns 0 on success */
+static int __write_all(int fd, const char *data, size_t length);
+
+/**************************************************
+********************* PRIVATE MACROS
+**************************************************/
+#define RECORD_READLEN (64 * 1024) /* most bytes read at once */
+#define RECORD_MODE (S_IRUSR | S_IWUSR | S_IRGRP) /* of saved files */
+
+/**************************************************
+********************* PRIVATE FUNCTIONS
+**************************************************/
+
+static int __write_all(int fd, const char *data, size_t length) {
+    ssize_t written=0;
+
+    while (length > 0) {
+        written = write(fd, data, length);
+        if (written < 0) {
+            if (errno == EINTR)
+                continue;
+            return 1;
+        }
+        data += written;
+        length -= written;
+    }
+    return 0;
+}
+
+/**************************************************
+********************* FUNCTIONS
+**************************************************/
+
+recorder_t *recorder_new(size_t size) {
+    recorder_t *recorder=NULL;
+
+    if ((size == 0) || (size > RECORD_MAXLEN))
+        return NULL;
+    recorder = malloc(sizeof(recorder_t));
+    memset(recorder, 0, sizeof(recorder_t));
+    /* anonymous, so a healthy run never touches the filesystem and 
+       untouched pages of a large ring cost nothing */
+    recorder->buffer = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (recorder->buffer == MAP_FAILED) {
+        fprintf(stderr, "ERROR: Map %lu byte recorder: %s\n", 
+                (unsigned long) size, strerror(errno));
+        free(recorder);
+        return NULL;
+    }
+    recorder->size = size;
+    return recorder;
+}
+
+void recorder_free(recorder_t *recorder) {
+    if (recorder == NULL)
+        return;
+    munmap(recorder->buffer, recorder->size);
+    free(recorder);
+}
+
+void recorder_relay(recorder_t *recorder, int outfd, int errfd,
+                    int pidfd) {
+    struct pollfd fds[3];
+    int targets[2] = { STDOUT_FILENO, STDERR_FILENO };
+    int forward[2] = { 1, 1 };
+    int streams=2;
+    int exited=0;
+    int ready=0;
+    int index=0;
+    size_t position=0;
+    size_t length=0;
+    ssize_t got=0;
+    struct sigaction ignore;
+    struct sigaction oldpipe;
+
+    /* a closed reader must not kill us before the command is reaped */
+    memset(&ignore, 0, sizeof(struct sigaction));
+    ignore.sa_handler = SIG_IGN;
+    sigaction(SIGPIPE, &ignore, &oldpipe);
+    fds[0].fd = outfd;
+    fds[1].fd = errfd;
+    fds[2].fd = pidfd; /* poll() ignores -1 */
+    fds[0].events = fds[1].events = fds[2].events = POLLIN;
+    while (streams > 0) {
+        /* Until the command exited, wait for more.  Anything it left
+           running may hold the pipes, but can't keep us from finishing */
+        ready = poll(fds, 3, (exited == 0) ? -1 : 0);
+        if (ready < 0) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        if (ready == 0)
+            break; /* exited, and nothing more waiting */
+        if (fds[2].revents != 0) {
+            exited = 1;
+            fds[2].fd = -1;
+        }
+        for (index = 0; index < 2; index++) {
+            if ((fds[index].fd < 0) || (fds[index].revents == 0))
+                continue;
+            /* read straight into the ring, then pass on from there */
+            position = recorder->written % recorder->size;
+            length = recorder->size - position;
+            if (length > RECORD_READLEN)
+                length = RECORD_READLEN;
+            got = read(fds[index].fd, recorder->buffer + position, length);
+            if ((got < 0) && ((errno == EINTR) || (errno == EAGAIN)))
+                continue;
+            if (got <= 0) { /* EOF, or nothing more will come */
+                close(fds[index].fd);
+                fds[index].fd = -1;
+                streams--;
+                continue;
+            }
+            recorder->written += got;
+            if ((forward[index] == 1) && 
+                (__write_all(targets[index], recorder->buffer + position,
+                             got) != 0))
+                forward[index] = 0;
+        }
+    }
+    for (index = 0; index < 2; index++)
+        if (fds[index].fd >= 0)
+            close(fds[index].fd);
+    sigaction(SIGPIPE, &oldpipe, NULL);
+}
+
+int recorder_save(recorder_t *recorder, const char const *path) {
+    char note[128];
+    size_t position=0;
+    int fd=-1;
+    int result=0;
+
+    fd = open(path, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, RECORD_MODE);
+    if (fd < 0) {
+        fprintf(stderr, "ERROR: Create %s: %s\n", path, strerror(errno));
+        return 1;
+    }
+    if (recorder->written <= recorder->size)
+        result = __write_all(fd, recorder->buffer, recorder->written);
+    else { /* ring wrapped, oldest byte is at next write position */
+        position = recorder->written % recorder->size;
+        snprintf(note, sizeof(note), "[first %lu bytes overwritten]\n",
+                 recorder->written - recorder->size);
+        result = __write_all(fd, note, strlen(note)) ||
+                 __write_all(fd, recorder->buffer + position,
+                             recorder->size - position) ||
+                 __write_all(fd, recorder->buffer, position);
+    }
+    if (result != 0)
+        fprintf(stderr, "ERROR: Write %s: %s\n", path, strerror(errno));
+    if (close(fd) != 0)
+        result = 1;
+    return result;
+}
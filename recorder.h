@@ -0,0 +1,70 @@
+/*
+#
+# Copyright (C) 2010 by Chris Evich <cevich@redhat.com>
+#
+#   This library is free software; you can redistribute it and/or
+#   modify it under the terms of the GNU Lesser General Public
+#   License as published by the Free Software Foundation; either
+#   version 2.1 of the License, or (at your option) any later version.
+#
+#   This library is distributed in the hope that it will be useful,
+#   but WITHOUT ANY WARRANTY; without even the implied warranty of
+#   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+#   Lesser General Public License for more details.
+#
+#   You should have received a copy of the GNU Lesser General Public
+#   License along with this library; if not, write to the Free Software
+#   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+#
+*/
+
+#ifndef _RECORDER_H
+#define _RECORDER_H
+
+/* users of this need: 
+    #include <sys/types.h>
+*/
+
+/**************************************************
+********************* MACROS
+**************************************************/
+#define RECORD_SUFFIX ".out" /* appended to saved recording file names */
+#define RECORD_MAXLEN (64 * 1024 * 1024) /* largest byte ring allowed */
+
+/**************************************************
+********************* TYPES
+**************************************************/
+
+/* Flight recorder, the last size bytes a command wrote to stdout and
+   stderr, interleaved as they arrived */
+typedef struct recorder_s {
+    char *buffer; /* mmap'd byte ring, never backed by a file */
+    size_t size; /* bytes in buffer */
+    unsigned long written; /* total appended, next goes at written % size */
+} recorder_t;
+
+/**************************************************
+********************* FUNCTION DEFINITIONS
+**************************************************/
+
+/* allocates and returns a recorder holding the last size bytes,
+   or NULL on failure */
+recorder_t *recorder_new(size_t size);
+
+/* frees recorder and it's byte ring, ignores NULL */
+void recorder_free(recorder_t *recorder);
+
+/* reads outfd and errfd until both reach EOF, or once pidfd (unless -1)
+   says the command exited, until no more is waiting.  Records 
+   everything while passing it on to our own stdout and stderr.  Closes
+   outfd and errfd. Stops passing on (but not recording) a stream whose
+   reader went away. */
+void recorder_relay(recorder_t *recorder, int outfd, int errfd, 
+                    int pidfd);
+
+/* writes recording to new file path, oldest byte first, noting how
+   much was overwritten if any.  Returns 0 on success, non-zero on 
+   failure */
+int recorder_save(recorder_t *recorder, const char const *path);
+
+#endif /* _RECORDER_H */
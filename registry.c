@@ -0,0 +1,327 @@
+/*
+#
+# Copyright (C) 2010 by Chris Evich <cevich@redhat.com>
+#
+#   This library is free software; you can redistribute it and/or
+#   modify it under the terms of the GNU Lesser General Public
+#   License as published by the Free Software Foundation; either
+#   version 2.1 of the License, or (at your option) any later version.
+#
+#   This library is distributed in the hope that it will be useful,
+#   but WITHOUT ANY WARRANTY; without even the implied warranty of
+#   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+#   Lesser General Public License for more details.
+#
+#   You should have received a copy of the GNU Lesser General Public
+#   License along with this library; if not, write to the Free Software
+#   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+#
+*/
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+#include "version.h"
+#include "registry.h"
+
+/**************************************************
+********************* PRIVATE FUNCTION DEFINITIONS
+**************************************************/
+
+/* returns FNV-1a hash of name */
+static unsigned long __registry_hash(const char const *name);
+
+/* waits for creator of fd's segment to size it, returns 0 once 
+   it has or 1 on timeout */
+static int __registry_sized(int fd);
+
+/* waits for creator to finish initializing registry, returns 0 once
+   it has or 1 on timeout */
+static int __registry_ready(registry_t *registry);
+
+/* initializes robust, process shared lock, unlocked */
+static void __registry_initlock(pthread_mutex_t *lock);
+
+/* takes registry lock, running __registry_recover() if the last holder
+   died with it.  Returns 0 when locked, or an error number */
+static int __registry_lock(registry_t *registry);
+
+/* repairs counters a holder killed in registry_add() or 
+   registry_remove() may have left half updated */
+static void __registry_recover(registry_t *registry);
+
+/**************************************************
+********************* PRIVATE MACROS
+**************************************************/
+#define REGISTRYLEN (REGISTRY_ARENA_OFFSET + REGISTRY_ARENALEN)
+#define REGISTRY_ARENA_OFFSET ( (sizeof(registry_t) + REGISTRY_ALIGN - 1) & \
+                                ~((unsigned long)REGISTRY_ALIGN - 1) )
+#define ARENAP(registry) (((char *) registry) + REGISTRY_ARENA_OFFSET)
+#define SLOTMASK (REGISTRY_SLOTS - 1)
+#define WAITTRIES 1000 /* times to check on registry creator */
+#define WAITNSEC 1000000 /* between checks, 1ms */
+#define ATOMIC_GET(ptr) __atomic_load_n((ptr), __ATOMIC_ACQUIRE)
+#define ATOMIC_SET(ptr, val) __atomic_store_n((ptr), (val), __ATOMIC_RELEASE)
+
+/**************************************************
+********************* PRIVATE GLOBALS
+**************************************************/
+static registry_t *__registry=NULL; /* mapped once per process */
+
+/**************************************************
+********************* PRIVATE FUNCTIONS
+**************************************************/
+
+static unsigned long __registry_hash(const char const *name) {
+    unsigned long hash=14695981039346656037UL;
+
+    for (; *name != '\0'; name++) {
+        hash ^= (unsigned char) *name;
+        hash *= 1099511628211UL;
+    }
+    return hash;
+}
+
+static int __registry_sized(int fd) {
+    struct stat s;
+    struct timespec pause = { 0, WAITNSEC };
+    int tries=0;
+
+    for (; tries < WAITTRIES; tries++) {
+        if ((fstat(fd, &s) == 0) && (s.st_size >= REGISTRYLEN))
+            return 0;
+        nanosleep(&pause, NULL);
+    }
+    return 1;
+}
+
+static int __registry_ready(registry_t *registry) {
+    struct timespec pause = { 0, WAITNSEC };
+    int tries=0;
+
+    for (; tries < WAITTRIES; tries++) {
+        if (ATOMIC_GET(&(registry->ready)) == 1)
+            return 0;
+        nanosleep(&pause, NULL);
+    }
+    return 1;
+}
+
+static void __registry_initlock(pthread_mutex_t *lock) {
+    pthread_mutexattr_t attr;
+
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    /* a killed holder hands EOWNERDEAD to the next locker, instead of
+       blocking every future --init and --fini forever */
+    pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+    pthread_mutex_init(lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+}
+
+static int __registry_lock(registry_t *registry) {
+    int result=0;
+
+    do {
+        result = pthread_mutex_lock(&(registry->lock));
+    } while (result == EINTR);
+    if (result == EOWNERDEAD) {
+        __registry_recover(registry);
+        result = pthread_mutex_consistent(&(registry->lock));
+        if (result != 0)
+            pthread_mutex_unlock(&(registry->lock));
+    }
+    return result;
+}
+
+static void __registry_recover(registry_t *registry) {
+    unsigned long index=0;
+    unsigned long arenaused=0;
+    unsigned long rings=0;
+    regslot_t *slot=NULL;
+
+    /* arena is handed out in order, so it ends after the last slot ever
+       published.  Space taken by an EMPTY slot that was never published
+       is handed out again */
+    for (; index < REGISTRY_SLOTS; index++) {
+        slot = &(registry->slots[index]);
+        if (slot->state == REGSLOT_EMPTY) {
+            /* registry_hold() only ever follows a USED slot */
+            __atomic_store_n(&(slot->attached), 0, __ATOMIC_SEQ_CST);
+            continue;
+        }
+        if (slot->state == REGSLOT_USED)
+            rings++;
+        if (slot->offset + slot->length > arenaused)
+            arenaused = slot->offset + slot->length;
+    }
+    registry->arenaused = arenaused;
+    registry->rings = rings;
+    __atomic_add_fetch(&(registry->lockrecoveries), 1, __ATOMIC_RELEASE);
+}
+
+/**************************************************
+********************* FUNCTIONS
+**************************************************/
+
+registry_t *registry_attach(void) {
+    registry_t *registry=NULL;
+    int fd=-1;
+    int created=0;
+
+    if (__registry != NULL)
+        return __registry;
+    fd = shm_open(REGISTRY_NAME, O_RDWR | O_CREAT | O_EXCL,
+                  S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
+    if (fd >= 0) {
+        created = 1;
+        if (ftruncate(fd, REGISTRYLEN) != 0) { /* zeros everything */
+            close(fd);
+            shm_unlink(REGISTRY_NAME);
+            return NULL;
+        }
+    } else { /* it exists, or we just lost a race creating it */
+        fd = shm_open(REGISTRY_NAME, O_RDWR, 0);
+        if ((fd < 0) || (__registry_sized(fd) != 0)) {
+            if (fd >= 0)
+                close(fd);
+            return NULL;
+        }
+    }
+    registry = mmap(NULL, REGISTRYLEN, PROT_READ | PROT_WRITE, MAP_SHARED,
+                    fd, 0);
+    close(fd);
+    if (registry == MAP_FAILED)
+        return NULL;
+    if (created == 1) {
+        __registry_initlock(&(registry->lock));
+        ATOMIC_SET(&(registry->ready), 1);
+    } else if (__registry_ready(registry) != 0) {
+        munmap(registry, REGISTRYLEN);
+        return NULL;
+    }
+    __registry = registry;
+    return registry;
+}
+
+regslot_t *registry_find(registry_t *registry, const char const *name) {
+    unsigned long index=0;
+    unsigned long probes=0;
+    regslot_t *slot=NULL;
+    int state=0;
+
+    index = __registry_hash(name) & SLOTMASK;
+    for (; probes < REGISTRY_SLOTS; probes++, index = (index + 1) & SLOTMASK) {
+        slot = &(registry->slots[index]);
+        state = ATOMIC_GET(&(slot->state));
+        if (state == REGSLOT_EMPTY)
+            return NULL; /* end of probe chain */
+        if ((state == REGSLOT_USED) &&
+            (strncmp(slot->name, name, REGISTRY_NAMELEN) == 0))
+            return slot;
+    }
+    return NULL;
+}
+
+regslot_t *registry_add(registry_t *registry, const char const *name,
+                        unsigned long length) {
+    unsigned long index=0;
+    unsigned long probes=0;
+    regslot_t *slot=NULL;
+    regslot_t *unused=NULL; /* first slot we could use */
+
+    if (strlen(name) >= REGISTRY_NAMELEN)
+        return NULL;
+    length = (length + REGISTRY_ALIGN - 1) & ~((unsigned long)REGISTRY_ALIGN - 1);
+    if ((errno = __registry_lock(registry)) != 0)
+        return NULL;
+    index = __registry_hash(name) & SLOTMASK;
+    for (; probes < REGISTRY_SLOTS; probes++, index = (index + 1) & SLOTMASK) {
+        slot = &(registry->slots[index]);
+        if (slot->state == REGSLOT_USED) {
+            if (strncmp(slot->name, name, REGISTRY_NAMELEN) == 0) {
+                unused = NULL; /* already exists */
+                break;
+            }
+        } else if (slot->state == REGSLOT_DELETED) {
+            /* reuse when big enough and nobody still has the old ring's
+               lock or counters mapped, but keep probing for a duplicate */
+            if ((unused == NULL) && (slot->length >= length) &&
+                (__atomic_load_n(&(slot->attached), __ATOMIC_SEQ_CST) == 0))
+                unused = slot;
+        } else { /* EMPTY, end of probe chain */
+            if ((unused == NULL) && 
+                (registry->arenaused + length <= REGISTRY_ARENALEN)) {
+                unused = slot;
+                unused->offset = registry->arenaused;
+                unused->length = length;
+                registry->arenaused += length;
+            }
+            break;
+        }
+    }
+    if (unused != NULL) {
+        /* registry_hold() racing with us now fails, before we touch it */
+        __atomic_add_fetch(&(unused->generation), 1, __ATOMIC_SEQ_CST);
+        __atomic_add_fetch(&(unused->attached), 1, __ATOMIC_SEQ_CST);
+        memset(unused->name, 0, REGISTRY_NAMELEN);
+        strncpy(unused->name, name, REGISTRY_NAMELEN - 1);
+        memset(ARENAP(registry) + unused->offset, 0, unused->length);
+        registry->rings += 1;
+        ATOMIC_SET(&(unused->state), REGSLOT_USED); /* now findable */
+    }
+    pthread_mutex_unlock(&(registry->lock));
+    return unused;
+}
+
+int registry_hold(registry_t *registry, regslot_t *slot,
+                  unsigned long *generation) {
+    *generation = __atomic_load_n(&(slot->generation), __ATOMIC_SEQ_CST);
+    __atomic_add_fetch(&(slot->attached), 1, __ATOMIC_SEQ_CST);
+    /* registry_add() either saw us attached and left it alone, or has
+       bumped generation already */
+    if ((__atomic_load_n(&(slot->state), __ATOMIC_SEQ_CST) == 
+         REGSLOT_USED) &&
+        (__atomic_load_n(&(slot->generation), __ATOMIC_SEQ_CST) == 
+         *generation))
+        return 0;
+    registry_release(registry, slot);
+    return 1;
+}
+
+void registry_release(registry_t *registry, regslot_t *slot) {
+    __atomic_sub_fetch(&(slot->attached), 1, __ATOMIC_SEQ_CST);
+}
+
+int registry_remove(registry_t *registry, regslot_t *slot) {
+    if ((errno = __registry_lock(registry)) != 0)
+        return 1;
+    if (slot->state == REGSLOT_USED) {
+        ATOMIC_SET(&(slot->state), REGSLOT_DELETED);
+        registry->rings -= 1;
+    }
+    pthread_mutex_unlock(&(registry->lock));
+    return 0;
+}
+
+void *registry_data(registry_t *registry, regslot_t *slot) {
+    return ARENAP(registry) + slot->offset;
+}
+
+regslot_t *registry_next(registry_t *registry, unsigned long *index) {
+    regslot_t *slot=NULL;
+
+    while (*index < REGISTRY_SLOTS) {
+        slot = &(registry->slots[*index]);
+        *index += 1;
+        if (ATOMIC_GET(&(slot->state)) == REGSLOT_USED)
+            return slot;
+    }
+    return NULL;
+}
@@ -0,0 +1,113 @@
+/*
+#
+# Copyright (C) 2010 by Chris Evich <cevich@redhat.com>
+#
+#   This library is free software; you can redistribute it and/or
+#   modify it under the terms of the GNU Lesser General Public
+#   License as published by the Free Software Foundation; either
+#   version 2.1 of the License, or (at your option) any later version.
+#
+#   This library is distributed in the hope that it will be useful,
+#   but WITHOUT ANY WARRANTY; without even the implied warranty of
+#   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+#   Lesser General Public License for more details.
+#
+#   You should have received a copy of the GNU Lesser General Public
+#   License along with this library; if not, write to the Free Software
+#   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+#
+*/
+
+#ifndef _REGISTRY_H
+#define _REGISTRY_H
+
+/* users of this need: 
+    #include <pthread.h>
+    #include "version.h"
+*/
+
+/**************************************************
+********************* MACROS
+**************************************************/
+#define REGISTRY_NAME PROGVERXY_s"--registry" /* '-' is never in a ring name */
+#define REGISTRY_SLOTS 1024 /* hash table size, power of two */
+#define REGISTRY_NAMELEN 256 /* longest ring name, including \0 */
+#define REGISTRY_ARENALEN (64UL * 1024 * 1024) /* bytes for all rings, only
+                                                  touched pages use memory */
+#define REGISTRY_ALIGN 64 /* arena allocations start on cache lines */
+
+/**************************************************
+********************* TYPES
+**************************************************/
+
+typedef enum regstate_e {
+    REGSLOT_EMPTY, /* never used, ends a probe */
+    REGSLOT_USED, /* holds a ring */
+    REGSLOT_DELETED, /* ring was destroyed, arena space kept for reuse
+                        once nothing is attached */
+} regstate_t;
+
+typedef struct regslot_s {
+    int state; /* regstate_t, published last when adding */
+    char name[REGISTRY_NAMELEN]; /* ring name, the hash key */
+    unsigned long offset; /* of ring data within arena */
+    unsigned long length; /* bytes reserved for ring data */
+    unsigned long generation; /* bumped every time slot is added, atomic */
+    unsigned long attached; /* processes holding ring data, atomic */
+} regslot_t;
+
+/* A single shared memory segment: header, open addressed hash table
+   of rings, then the arena holding each ring's data */
+typedef struct registry_s {
+    int ready; /* set once creator finished initializing */
+    pthread_mutex_t lock; /* robust and process shared, guards adding
+                             and removing slots */
+    unsigned long arenaused; /* bytes of arena ever allocated */
+    unsigned long rings; /* slots in REGSLOT_USED state */
+    unsigned long lockrecoveries; /* times a lock holder died */
+    regslot_t slots[REGISTRY_SLOTS];
+} registry_t;
+
+/**************************************************
+********************* FUNCTION DEFINITIONS
+**************************************************/
+
+/* maps registry segment, creating it if needed.  Only the first call
+   in a process does any work.  Returns NULL on failure */
+registry_t *registry_attach(void);
+
+/* returns USED slot named name, or NULL if none. Requires no locking. */
+regslot_t *registry_find(registry_t *registry, const char const *name);
+
+/* counts caller as attached to slot's ring data, so registry_add() 
+   can't re-initialize it, setting *generation.  Returns 0 on success,
+   or non-zero if slot was removed or is being reused meanwhile.  A 
+   process dying attached leaves the slot's space unused for good. 
+   Requires no locking. */
+int registry_hold(registry_t *registry, regslot_t *slot,
+                  unsigned long *generation);
+
+/* undoes registry_hold() or registry_add() of slot. Requires no 
+   locking. */
+void registry_release(registry_t *registry, regslot_t *slot);
+
+/* adds slot named name with length zeroed bytes of ring data, held by
+   the caller like registry_hold(), or returns NULL if name exists or
+   there's no room or the lock failed.  Reuses a DELETED slot only 
+   once nothing is attached to it any more */
+regslot_t *registry_add(registry_t *registry, const char const *name,
+                        unsigned long length);
+
+/* marks slot DELETED.  Ring data is left in place, other processes
+   may still be using it.  Returns 0 on success, non-zero if the lock
+   failed */
+int registry_remove(registry_t *registry, regslot_t *slot);
+
+/* returns pointer to slot's ring data in the arena */
+void *registry_data(registry_t *registry, regslot_t *slot);
+
+/* returns first USED slot at or after *index, setting *index to the
+   following one, or NULL when there are no more. Requires no locking. */
+regslot_t *registry_next(registry_t *registry, unsigned long *index);
+
+#endif /* _REGISTRY_H */
@@ -19,21 +19,31 @@
 */
 
 #include <sys/types.h>
+#include <sys/stat.h>
 #include <sys/mman.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <stdlib.h>
 #include <string.h>
 #include <semaphore.h>
+#include <pthread.h>
 #include <stdio.h>
+#include <signal.h>
+#include <errno.h>
+#include <time.h>
+#include <limits.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
 #include "version.h"
 #include "utility.h"
+#include "histogram.h"
+#include "registry.h"
 #include "ring.h"
 
 /**************************************************
 ********************* PRIVATE FUNCTION DEFINITIONS
 **************************************************/
-/* returns newly allocated shm/sem name composed of the concatenation
+/* returns newly allocated shm name composed of the concatenation
    of the parameters in the form:  <PROGNVR_s>-<cmdbasename><unique> */
 static char *__new_name(const char const *cmdbasename,
                         const char const *unique);
@@ -45,35 +55,76 @@ static shmseg_t *__new_shmseg(unsigned long keep,
                               const char const *outdir,
                               const char const *wrapper);
 
+/* sets initial values of zeroed shmseg, leaving it's lock LOCKED */
+static void __init_shmseg(shmseg_t *shmseg,
+                          unsigned long keep,
+                          const char const *outdir,
+                          const char const *wrapper);
+
 /* returns existing shared memory segment referenced by name 
    or NULL on failure */
 static shmseg_t *__get_shmseg(const char const *name);
 
+/* waits for creator to finish initializing shmseg, returns 0 once 
+   it has or 1 on timeout */
+static int __shmseg_ready(shmseg_t *shmseg);
+
 /* unmapps shared memory segment process address space - DOES NOT DESTROY IT */
 static void __free_shmseg(shmseg_t *shmseg);
 
-/* creates a new LOCKED named semaphore and returns it
-   or NULL on failure / if one already exists with name */
-static sem_t *__new_locked_sem(const char const *name);
+/* initializes robust, process shared lock and takes it */
+static void __init_lock(pthread_mutex_t *lock);
 
-/* locks and returns existing named semaphore or NULL on failure */
-static sem_t *__get_locked_sem(const char const *name);
+/* repairs what a holder of the lock that died may have left half 
+   written.  Requires Locking. */
+static void __lock_recover(shared_t *shared);
 
-/* closes named semaphore, does not destroy it */
-static void __free_sem(sem_t *sem);
+/* Return pointer to logring slot (not entry) or NULL if out of range */
+static logentry_t *__logring_slot(shared_t *shared, size_t slot);
 
-/* Return pointer to logring element index or NULL if index out of range */
-static char *__logring_index(shared_t *shared, size_t index);
+/* Return pointer to index'th oldest entry or NULL if index out of range */
+static logentry_t *__logring_index(shared_t *shared, size_t index);
 
-/* returns pointer to last empty entry in logring vector
+/* returns pointer to slot following newest entry in logring
    or NULL if logring full.  */
-static char *__logring_endptr(shared_t *shared);
+static logentry_t *__logring_endptr(shared_t *shared);
 
-/* returns NULL if logring vector is not full, otherwise
-   returns copy of first element, and moves all elements
-   up, overwriting the first. */
+/* returns NULL if logring vector is empty, otherwise removes oldest
+   entry and returns copy of it's path, or NULL if it only lived in the
+   arena.  Requires locking. */
 static char *__logring_pop(shared_t *shared);
 
+/* adds copy of entry to evictqueue and wakes worker.  Returns 1 if 
+   queue is full and entry was not added.  Requires locking. */
+static int __evict_enqueue(shared_t *shared, const char const *entry);
+
+/* claims a free slot among the first maxconcurrent, returns it's index 
+   or -1 if none are free */
+static int __inflight_claim(shmseg_t *shmseg, unsigned long maxconcurrent);
+
+/* frees slots held by processes that no longer exist, returns number
+   freed. */
+static int __inflight_reclaim(shmseg_t *shmseg, unsigned long maxconcurrent);
+
+/* Make sequence odd so get_config() readers retry, waits for any 
+   other writer to finish first */
+static void __config_write_begin(shmseg_t *shmseg);
+
+/* Make sequence even again, publishing writes to get_config() readers */
+static void __config_write_end(shmseg_t *shmseg);
+
+/* Ends tracing if window id is still open, taking the lock */
+static void __window_close(shared_t *shared, unsigned long id);
+
+/* called by lock free readers every time they find a write in progress,
+   returning tries to carry on with.  Once that took SEQLOCKSPINS tries,
+   takes and releases the lock, waiting out a live writer or recovering
+   from a dead one (whose sequence would stay odd forever) */
+static unsigned long __seqlock_wait(shared_t *shared, unsigned long tries);
+
+/* returns CLOCK_MONOTONIC now in nanoseconds, the same in every process */
+static unsigned long __monotonic_ns(void);
+
 /* Allocates memory for new shared_t structure */
 static shared_t *__allocate_shared_t(const char const *cmdbasename,
                                      const char const *unique);
@@ -81,11 +132,29 @@ static shared_t *__allocate_shared_t(const char const *cmdbasename,
 ********************* PRIVATE MACROS
 **************************************************/
 #define SHMSEGLEN(keep) ( sizeof(shmseg_t)+/*one arry included free of charge*/\
-                          ((keep - 1) * (MAXDIRSTRLEN)) \
+                          ((keep - 1) * sizeof(logentry_t)) \
                         )
 #define OUTDIRP(shared) (&(shared->shmseg->outdir))
 #define WRAPPERP(shared) (&(shared->shmseg->wrapper))
-#define LOGRINGP(shared) ((char*) &(shared->shmseg->logring))
+#define LOGRINGP(shared) (shared->shmseg->logring)
+#define LOGRINGLEN(shared) (shared->shmseg->keep - 1)
+#define COUNTERSNAPTRIES 8 /* re-reads before settling for a snapshot */
+#define ATOMIC_INC(ptr) __atomic_fetch_add((ptr), 1, __ATOMIC_RELAXED)
+#define ATOMIC_ADD(ptr, val) __atomic_fetch_add((ptr), (val), __ATOMIC_RELAXED)
+#define ATOMIC_SUB(ptr, val) __atomic_fetch_sub((ptr), (val), __ATOMIC_RELAXED)
+#define ATOMIC_GET(ptr) __atomic_load_n((ptr), __ATOMIC_ACQUIRE)
+#define ATOMIC_SET(ptr, val) __atomic_store_n((ptr), (val), __ATOMIC_RELEASE)
+#define NSEC_PER_SEC 1000000000UL
+#define WAITTRIES 1000 /* times to check on shmseg creator */
+#define WAITNSEC 1000000 /* between checks, 1ms */
+#define SEQLOCKSPINS 1024 /* odd sequences seen before taking the lock */
+
+#ifdef BENCHMARK
+/**************************************************
+********************* PRIVATE GLOBALS
+**************************************************/
+static unsigned long __lockwait=0; /* nanoseconds spent in lock_shared() */
+#endif
 
 /**************************************************
 ********************* PRIVATE FUNCTIONS
@@ -117,44 +186,71 @@ static shmseg_t *__new_shmseg(unsigned long keep,
                       fd, 0);
         close(fd);
         if (newone != MAP_FAILED) {
-            /* guarantee null terminators */
-            if (outdir != NULL)
-                strncpy(newone->outdir, outdir, MAXDIRSTRLEN - 1);
-            strncpy(newone->wrapper, wrapper, MAXCOMMANDLEN - 1);
-            newone->keep = keep;
             /* ftruncate guarantees everything else is zeros */
+            __init_shmseg(newone, keep, outdir, wrapper);
             return newone;
         }
     }
     return NULL;
 }
 
+static void __init_shmseg(shmseg_t *shmseg,
+                          unsigned long keep,
+                          const char const *outdir,
+                          const char const *wrapper) {
+    /* guarantee null terminators */
+    if (outdir != NULL)
+        strncpy(shmseg->outdir, outdir, MAXDIRSTRLEN - 1);
+    strncpy(shmseg->wrapper, wrapper, MAXCOMMANDLEN - 1);
+    shmseg->keep = keep;
+    shmseg->created = time(NULL);
+    sem_init(&(shmseg->evictwake), 1, 0); /* process shared */
+    sem_init(&(shmseg->eventwake), 1, 0);
+    __init_lock(&(shmseg->lock));
+    ATOMIC_SET(&(shmseg->ready), 1); /* now lockable by others */
+}
+
 
 static shmseg_t *__get_shmseg(const char const *name) {
     shmseg_t *shmseg=NULL;
+    struct stat s;
+    struct timespec pause = { 0, WAITNSEC };
+    int tries=0;
     int fd;
-    unsigned long keep=0;
     
     fd = shm_open(name, O_RDWR, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
-    if (fd > 0) {
-        /* need to mmap it twice to get stored size */
-        shmseg = mmap(NULL, sizeof(shmseg_t), 
-                      PROT_READ | PROT_WRITE, MAP_SHARED,
+    if (fd < 0)
+        return NULL;
+    /* creator sizes it for keep before anything else, so the stored
+       size is the mapping size and one mmap does */
+    for (; tries < WAITTRIES; tries++) {
+        if ((fstat(fd, &s) == 0) && (s.st_size >= (off_t) sizeof(shmseg_t)))
+            break;
+        nanosleep(&pause, NULL);
+    }
+    if (tries < WAITTRIES)
+        shmseg = mmap(NULL, s.st_size, PROT_READ | PROT_WRITE, MAP_SHARED,
                       fd, 0);
-        if (shmseg != MAP_FAILED) {
-            keep = shmseg->keep;
-            munmap(shmseg, sizeof(shmseg_t));
-            if (keep > 0) { /* must always be at least 1 */
-                shmseg = (shmseg_t *) mmap(NULL, SHMSEGLEN(keep),
-                                           PROT_READ | PROT_WRITE, MAP_SHARED,
-                                           fd, 0);
-                if (shmseg != MAP_FAILED)
-                    return shmseg;
-            }
-        }
-        close(fd);
+    close(fd);
+    if ((shmseg == NULL) || (shmseg == MAP_FAILED))
+        return NULL;
+    if (__shmseg_ready(shmseg) != 0) {
+        munmap(shmseg, s.st_size);
+        return NULL;
     }
-    return NULL;
+    return shmseg;
+}
+
+static int __shmseg_ready(shmseg_t *shmseg) {
+    struct timespec pause = { 0, WAITNSEC };
+    int tries=0;
+
+    for (; tries < WAITTRIES; tries++) {
+        if (ATOMIC_GET(&(shmseg->ready)) == 1)
+            return 0;
+        nanosleep(&pause, NULL);
+    }
+    return 1;
 }
 
 static void __free_shmseg(shmseg_t *shmseg) {
@@ -166,85 +262,176 @@ static void __free_shmseg(shmseg_t *shmseg) {
     }
 }
 
-static sem_t *__new_locked_sem(const char const *name) {
-    sem_t *sem=NULL;
+static void __init_lock(pthread_mutex_t *lock) {
+    pthread_mutexattr_t attr;
 
-    sem = sem_open(name, 
-                   O_CREAT | O_EXCL,
-                   S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP,
-                   0);
-    if (sem == SEM_FAILED)
-        return NULL;
-    return sem;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    /* a killed holder hands EOWNERDEAD to the next locker, instead of
+       blocking every future one forever */
+    pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+    pthread_mutex_init(lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+    pthread_mutex_lock(lock);
 }
 
-static sem_t *__get_locked_sem(const char const *name) {
-    sem_t *sem=NULL;
+static void __lock_recover(shared_t *shared) {
+    shmseg_t *shmseg = shared->shmseg;
 
-    sem = sem_open(name, 0);
-    if (sem == SEM_FAILED)
-        return NULL;
-    sem_wait(sem);
-    return sem;
+    /* died between __config_write_begin() and __config_write_end() */
+    if ((__atomic_load_n(&(shmseg->sequence), __ATOMIC_RELAXED) & 1) != 0)
+        __config_write_end(shmseg);
+    /* died in logring_roll() or evict_dequeue(), worst case an entry
+       is lost or repeated, but indexes stay in range */
+    if ((shmseg->logsequence & 1) != 0)
+        __atomic_fetch_add(&(shmseg->logsequence), 1, __ATOMIC_RELEASE);
+    if (LOGRINGLEN(shared) == 0) {
+        shmseg->head = 0;
+        shmseg->count = 0;
+    } else {
+        shmseg->head %= LOGRINGLEN(shared);
+        if (shmseg->count > LOGRINGLEN(shared))
+            shmseg->count = LOGRINGLEN(shared);
+    }
+    shmseg->evicthead %= EVICTQUEUELEN;
+    if (shmseg->evictcount > EVICTQUEUELEN)
+        shmseg->evictcount = EVICTQUEUELEN;
+    ATOMIC_INC(&(shmseg->lockrecoveries));
 }
 
-static void __free_sem(sem_t *sem) {
-    sem_close(sem);
+static logentry_t *__logring_slot(shared_t *shared, size_t slot) {
+    if (slot >= LOGRINGLEN(shared))
+        return NULL;
+    return LOGRINGP(shared) + slot;
 }
 
-static char *__logring_index(shared_t *shared, size_t index) {
-    size_t offset=0;
-    char *entry=NULL;
-
-    if (index >= (shared->shmseg->keep - 1)) /* at/beyond terminator index*/
+static logentry_t *__logring_index(shared_t *shared, size_t index) {
+    if (index >= shared->shmseg->count)
         return NULL;
-    offset = index * MAXDIRSTRLEN;
-    entry = LOGRINGP(shared) + offset;
-    return entry;
+    /* slots wrap around, oldest entry is at head */
+    return __logring_slot(shared,
+                          (shared->shmseg->head + index) % LOGRINGLEN(shared));
 }
 
-char *__logring_endptr(shared_t *shared) {
-    size_t counter = shared->shmseg->keep - 2; /*last possible non-term entry */
-    char *endptr = __logring_index(shared, counter);
-    
-    /* searching backwards is the fastest assuming full log */
-    while( (*endptr == '\0') && (counter > 0) ) {
-        counter--;
-        endptr = __logring_index(shared, counter);
-    }
-    if ( counter >= (shared->shmseg->keep - 2) )
+static logentry_t *__logring_endptr(shared_t *shared) {
+    if (shared->shmseg->count >= LOGRINGLEN(shared))
         return NULL; /* logring is full */
-    else if (*endptr != '\0') /* return next, but not last entry) */
-        return __logring_index(shared, counter + 1);
-    else /* log is totally empty, return first entry */
-        return LOGRINGP(shared); /* log is entirely empty */
+    return __logring_slot(shared,
+                          (shared->shmseg->head + shared->shmseg->count) %
+                          LOGRINGLEN(shared));
 }
 
 static char *__logring_pop(shared_t *shared) {
-    char *endptr=NULL;
-    char *entry2=NULL;
     char *popped=NULL;
-    size_t copylength=0;
-
-    /* point at second to last entry */
-    endptr = __logring_index(shared, shared->shmseg->keep - 2);
-    /* Check if logring is full */
-    if (*endptr == '\0')
-        return NULL; /* not full, nothing to pop */
-    /* make copy of entry to return */
-    popped = utility_strcpy( __logring_index(shared, 0)  );
-    /* point at second entry */
-    entry2 = __logring_index(shared, 1);
-    /* -1 means move trailing terminator entry as well */
-    copylength = (shared->shmseg->keep - 1) * MAXDIRSTRLEN;
-    /* copy entry #2 through/including trailing terminator, one position up */
-    memmove( LOGRINGP(shared), entry2, copylength);
-    /* guarantee last two entries are full of \0's */
-    endptr = __logring_index(shared, shared->shmseg->keep - 2);
-    memset(endptr, 0, MAXDIRSTRLEN * 2);
+    logentry_t *oldest=NULL;
+
+    if (shared->shmseg->count == 0)
+        return NULL; /* nothing to pop */
+    oldest = __logring_slot(shared, shared->shmseg->head);
+    /* make copy of entry to return, arena segments are simply reused */
+    if (oldest->arenaseq == 0)
+        popped = utility_strcpy(oldest->path);
+    ATOMIC_SUB(&(shared->shmseg->totalbytes), oldest->bytes);
+    memset(oldest, 0, sizeof(logentry_t));
+    /* next oldest becomes head, it's slot is now free at end */
+    shared->shmseg->head = (shared->shmseg->head + 1) % LOGRINGLEN(shared);
+    shared->shmseg->count -= 1;
     return popped;
 }
 
+static int __evict_enqueue(shared_t *shared, const char const *entry) {
+    shmseg_t *shmseg = shared->shmseg;
+    char *slot=NULL;
+
+    if (shmseg->evictcount >= EVICTQUEUELEN)
+        return 1;
+    slot = shmseg->evictqueue[(shmseg->evicthead + shmseg->evictcount) %
+                              EVICTQUEUELEN];
+    strncpy(slot, entry, MAXDIRSTRLEN - 1);
+    slot[MAXDIRSTRLEN - 1] = '\0';
+    shmseg->evictcount += 1;
+    sem_post(&(shmseg->evictwake)); /* only a syscall if worker waiting */
+    return 0;
+}
+
+static int __inflight_claim(shmseg_t *shmseg, unsigned long maxconcurrent) {
+    pid_t mypid = getpid();
+    pid_t expected=0;
+    unsigned long slot=0;
+
+    for (;slot < maxconcurrent; slot++) {
+        expected = 0;
+        if (__atomic_compare_exchange_n(&(shmseg->inflightpids[slot]),
+                                        &expected, mypid, 0,
+                                        __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+            return slot;
+    }
+    return -1;
+}
+
+static int __inflight_reclaim(shmseg_t *shmseg, unsigned long maxconcurrent) {
+    pid_t holder=0;
+    unsigned long slot=0;
+    int freed=0;
+
+    for (;slot < maxconcurrent; slot++) {
+        holder = __atomic_load_n(&(shmseg->inflightpids[slot]),
+                                 __ATOMIC_RELAXED);
+        if ((holder == 0) || (kill(holder, 0) == 0) || (errno != ESRCH))
+            continue; /* free or holder alive */
+        /* only free it if nobody beat us to it */
+        if (__atomic_compare_exchange_n(&(shmseg->inflightpids[slot]),
+                                        &holder, 0, 0,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+            __atomic_fetch_sub(&(shmseg->inflight), 1, __ATOMIC_RELAXED);
+            freed++;
+        }
+    }
+    return freed;
+}
+
+static void __config_write_begin(shmseg_t *shmseg) {
+    unsigned long sequence=0;
+
+    do {
+        sequence = __atomic_load_n(&(shmseg->sequence), __ATOMIC_RELAXED);
+    } while ( ((sequence & 1) != 0) || /* another writer in progress */
+              (__atomic_compare_exchange_n(&(shmseg->sequence),
+                                           &sequence, sequence + 1, 0,
+                                           __ATOMIC_RELAXED,
+                                           __ATOMIC_RELAXED) == 0) );
+    /* odd sequence must be visible before any following writes */
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static void __config_write_end(shmseg_t *shmseg) {
+    __atomic_fetch_add(&(shmseg->sequence), 1, __ATOMIC_RELEASE);
+}
+
+static void __window_close(shared_t *shared, unsigned long id) {
+    if (ATOMIC_GET(&(shared->shmseg->windowid)) != id)
+        return; /* someone else ended it, or a new one began */
+    lock_shared(shared);
+    if ((shared->shmseg->windowid == id) && (get_tracing(shared) == 1))
+        unset_tracing(shared);
+    unlock_shared(shared);
+}
+
+static unsigned long __seqlock_wait(shared_t *shared, unsigned long tries) {
+    if (++tries < SEQLOCKSPINS)
+        return tries;
+    lock_shared(shared); /* runs __lock_recover() if writer died */
+    unlock_shared(shared);
+    return 0;
+}
+
+static unsigned long __monotonic_ns(void) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec * 1000000000UL) + now.tv_nsec;
+}
+
 static shared_t *__allocate_shared_t(const char const *cmdbasename,
                                      const char const *unique) {
     shared_t *shared=NULL;
@@ -260,118 +447,1009 @@ static shared_t *__allocate_shared_t(const char const *cmdbasename,
 **************************************************/
 
 void lock_shared(shared_t *shared) {
-    sem_wait(shared->sem);
+#ifdef BENCHMARK
+    struct timespec start;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+#endif
+    if (pthread_mutex_lock(&(shared->shmseg->lock)) == EOWNERDEAD) {
+        __lock_recover(shared);
+        pthread_mutex_consistent(&(shared->shmseg->lock));
+    }
+#ifdef BENCHMARK
+    __lockwait += utility_nsecsince(&start);
+#endif
+}
+
+#ifdef BENCHMARK
+unsigned long lock_waited(void) {
+    return __lockwait;
 }
+#endif
 
 void unlock_shared(shared_t *shared) {
-    sem_post(shared->sem);
+    pthread_mutex_unlock(&(shared->shmseg->lock));
 }
 
 shared_t *new_shared(unsigned long keep,
                      const char const *outdir,
                      const char const *wrapper,
                      const char const *cmdbasename,
-                     const char const *unique) {
+                     const char const *unique,
+                     int registry) {
     shared_t *newone=NULL;
 
-    if ((cmdbasename == NULL) || (unique == NULL))
+    if ((cmdbasename == NULL) || (unique == NULL) || (wrapper == NULL) ||
+        (keep < 1))
         return NULL;
     newone = __allocate_shared_t(cmdbasename,unique);
-    newone->sem = __new_locked_sem(newone->name);
-    if (newone->sem != NULL) {
-        newone->shmseg = __new_shmseg(keep, newone->name, outdir, wrapper);
-        unlock_shared(newone);
-        if (newone->shmseg != NULL) 
-            return newone;
+    if (registry == 1) {
+        if (outdir == NULL)
+            keep = 1; /* force to empty logring */
+        newone->registry = registry_attach();
+        if (newone->registry != NULL)
+            newone->slot = registry_add(newone->registry, newone->name,
+                                        SHMSEGLEN(keep));
+        if (newone->slot != NULL) { /* held, free_shared() releases */
+            newone->slotgeneration = newone->slot->generation;
+            newone->shmseg = registry_data(newone->registry, newone->slot);
+            __init_shmseg(newone->shmseg, keep, outdir, wrapper); /* LOCKED */
+            return newone; /* still locked, caller unlocks */
+        }
+        free_shared(newone); /* only free memory */
+        return NULL;
     }
-    /* failed to create semaphore or shared memory */
+    newone->shmseg = __new_shmseg(keep, newone->name, outdir, wrapper);
+    if (newone->shmseg != NULL) 
+        return newone; /* still locked, caller unlocks */
+    /* failed to create shared memory */
     free_shared(newone); /* only free memory */
     return NULL;
 }
 
 shared_t *get_shared(const char const *cmdbasename,
-                     const char const *unique) {
+                     const char const *unique,
+                     int registry) {
     shared_t *newone=NULL;
+    char *name=NULL;
+
+    name = __new_name(cmdbasename, unique);
+    newone = get_shared_byname(name, registry);
+    free(name);
+    return newone;
+}
+
+shared_t *get_shared_byname(const char const *name, int registry) {
+    shared_t *newone=NULL;
+    regslot_t *slot=NULL;
     
-    newone = __allocate_shared_t(cmdbasename,unique);
-    newone->sem = __get_locked_sem(newone->name);
-    if (newone->sem != NULL) {
-        newone->shmseg = __get_shmseg(newone->name);
-        unlock_shared(newone); /* unlock */
-        if (newone->shmseg != NULL) {
-            return newone;
+    newone = malloc(sizeof(shared_t));
+    memset(newone,0,sizeof(shared_t));
+    newone->name = utility_strcpy(name);
+    if (registry == 1) {
+        /* One mapping per process, and no lock needed to find the ring */
+        newone->registry = registry_attach();
+        if (newone->registry != NULL)
+            slot = registry_find(newone->registry, newone->name);
+        /* name is only stable once held, it might have been reused */
+        if ((slot != NULL) && 
+            (registry_hold(newone->registry, slot, 
+                           &(newone->slotgeneration)) == 0)) {
+            newone->slot = slot; /* free_shared() releases it */
+            newone->shmseg = registry_data(newone->registry, newone->slot);
+            if ((strncmp(slot->name, newone->name, REGISTRY_NAMELEN) == 0) &&
+                (__shmseg_ready(newone->shmseg) == 0))
+                return newone;
         }
+        free_shared(newone); /* only free memory */
+        free(newone);
+        return NULL;
     }
+    /* single shm_open and mmap, the lock is inside */
+    newone->shmseg = __get_shmseg(newone->name);
+    if (newone->shmseg != NULL)
+        return newone;
     free_shared(newone); /* only free memory */
+    free(newone);
     return NULL;
 }
 
+int shared_alive(shared_t *shared) {
+    int fd=-1;
+
+    if ((shared == NULL) || (shared->shmseg == NULL))
+        return 0;
+    /* a slot USED again may hold another ring, or ours re-created */
+    if (shared->registry != NULL)
+        return ((ATOMIC_GET(&(shared->slot->state)) == REGSLOT_USED) &&
+                (ATOMIC_GET(&(shared->slot->generation)) == 
+                 shared->slotgeneration) &&
+                (strncmp(shared->slot->name, shared->name, 
+                         REGISTRY_NAMELEN) == 0));
+    fd = shm_open(shared->name, O_RDONLY, 0);
+    if (fd < 0)
+        return 0;
+    close(fd);
+    return 1;
+}
+
+shared_t *next_shared(unsigned long *index) {
+    shared_t *newone=NULL;
+    registry_t *registry=NULL;
+    regslot_t *slot=NULL;
+    unsigned long generation=0;
+
+    registry = registry_attach();
+    if (registry == NULL)
+        return NULL;
+    do { /* skip any removed or reused since registry_next() saw it */
+        if ((slot = registry_next(registry, index)) == NULL)
+            return NULL;
+    } while (registry_hold(registry, slot, &generation) != 0);
+    newone = malloc(sizeof(shared_t));
+    memset(newone,0,sizeof(shared_t));
+    newone->name = utility_strcpy(slot->name);
+    newone->registry = registry;
+    newone->slot = slot;
+    newone->slotgeneration = generation;
+    newone->shmseg = registry_data(registry, slot);
+    return newone;
+}
+
+int hold_shared(shared_t *shared) {
+    unsigned long generation=0;
+
+    if ((shared == NULL) || (shared->registry == NULL))
+        return 0;
+    if (registry_hold(shared->registry, shared->slot, &generation) != 0)
+        return 1;
+    if (generation != shared->slotgeneration) { /* another ring's now */
+        registry_release(shared->registry, shared->slot);
+        return 1;
+    }
+    return 0;
+}
+
 void free_shared(shared_t *shared) {
     if (shared != NULL) {
-        __free_sem(shared->sem);
-        __free_shmseg(shared->shmseg);
+        if (shared->registry == NULL) /* registry stays mapped */
+            __free_shmseg(shared->shmseg);
+        else if (shared->slot != NULL) /* slot may be reused now */
+            registry_release(shared->registry, shared->slot);
         free(shared->name);
         memset(shared,0,sizeof(shared_t));
     }
 }
 
-void destroy_shared(shared_t *shared) {
+int destroy_shared(shared_t *shared) {
     char *name_copy=NULL;
+    int result=0;
 
-    if (shared != NULL) {
+    if ((shared != NULL) && (shared->registry != NULL)) {
+        result = registry_remove(shared->registry, shared->slot);
+        unlock_shared(shared); /* waiters find it removed */
+        free_shared(shared);
+    } else if (shared != NULL) {
         name_copy = utility_strcpy(shared->name); /* free_shared frees name */
+        result = shm_unlink(name_copy);
+        unlock_shared(shared); /* waiters keep their mapping until done */
         free_shared(shared);
-        shm_unlink(name_copy);
-        sem_unlink(name_copy);
         free(name_copy);      
     }
+    return result;
 }
 
-const char *logring_index(shared_t *shared, size_t index) {
-    return (const char *)__logring_index(shared,index);
+const logentry_t *logring_index(shared_t *shared, size_t index) {
+    return (const logentry_t *)__logring_index(shared,index);
 }
 
-char *logring_roll(shared_t *shared, const char const *newentry) {
+char *logring_roll(shared_t *shared, const char const *newentry,
+                   unsigned long bytes, unsigned long arenaseq) {
+    shmseg_t *shmseg=NULL;
     char *popped=NULL;
-    char *endptr=NULL;
-    char *newentrycopy=NULL;
+    char *overquota=NULL;
+    logentry_t *endptr=NULL;
 
     if ((shared == NULL) || (shared->shmseg->keep < 3) || (newentry == NULL))
         return NULL; /* nothing to do */
+    shmseg = shared->shmseg;
     lock_shared(shared);
+    /* only writer, no need for __config_write_begin()'s loop */
+    __atomic_fetch_add(&(shmseg->logsequence), 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
     endptr = __logring_endptr(shared);
     if (endptr == NULL) { /* log is FULL */
-        popped = __logring_pop(shared); /* also rotates entries */
+        popped = __logring_pop(shared); /* frees oldest slot */
         endptr = __logring_endptr(shared); /* get new end */
     }
-    newentrycopy = malloc(MAXDIRSTRLEN);
-    memset(newentrycopy,0,MAXDIRSTRLEN);
+    memset(endptr, 0, sizeof(logentry_t));
     /* guarantee newentry size and terminating NULL */
-    strncpy(newentrycopy, newentry, MAXDIRSTRLEN - 1);
-    memcpy(endptr,newentrycopy,MAXDIRSTRLEN);
+    strncpy(endptr->path, newentry, MAXDIRSTRLEN - 1);
+    endptr->bytes = bytes;
+    endptr->arenaseq = arenaseq;
+    shmseg->count += 1;
+    ATOMIC_ADD(&(shmseg->totalbytes), bytes);
+    if ((popped != NULL) && (__evict_enqueue(shared, popped) == 0)) {
+        free(popped); /* worker will remove it */
+        popped = NULL;
+    }
+    /* enforce byte quota.  With the worker behind, our caller removes
+       one itself like a full queue above, but only the one */
+    while ((shmseg->maxbytes > 0) &&
+           (shmseg->totalbytes > shmseg->maxbytes) &&
+           (shmseg->count > 1)) {
+        if (shmseg->evictcount < EVICTQUEUELEN) {
+            overquota = __logring_pop(shared);
+            if (overquota != NULL)
+                __evict_enqueue(shared, overquota);
+            free(overquota);
+        } else if (popped == NULL)
+            popped = __logring_pop(shared); /* NULL for arena, go on */
+        else
+            break;
+    }
+    if ((shmseg->maxbytes > 0) && (shmseg->totalbytes > shmseg->maxbytes) &&
+        (shmseg->count > 1))
+        ATOMIC_INC(&(shmseg->quotaoverruns));
+    __atomic_fetch_add(&(shmseg->logsequence), 1, __ATOMIC_RELEASE);
     unlock_shared(shared);
-    free(newentrycopy);
     return popped;
 }
 
+size_t evict_dequeue(shared_t *shared, char **entries, size_t max,
+                     int seconds) {
+    shmseg_t *shmseg = shared->shmseg;
+    struct timespec deadline;
+    size_t dequeued=0;
+    size_t extraposts=0;
+
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += seconds;
+    if (sem_timedwait(&(shmseg->evictwake), &deadline) != 0)
+        return 0; /* timeout or signal */
+    lock_shared(shared);
+    for (;(dequeued < max) && (shmseg->evictcount > 0); dequeued++) {
+        entries[dequeued] = utility_strcpy(shmseg->evictqueue[shmseg->evicthead]);
+        shmseg->evicthead = (shmseg->evicthead + 1) % EVICTQUEUELEN;
+        shmseg->evictcount -= 1;
+    }
+    __atomic_fetch_add(&(shmseg->evicting), dequeued, __ATOMIC_RELAXED);
+    unlock_shared(shared);
+    /* one post per entry, consume the rest of this batch's posts */
+    for (extraposts = 1; extraposts < dequeued; extraposts++)
+        sem_trywait(&(shmseg->evictwake));
+    return dequeued;
+}
+
+void evict_done(shared_t *shared, size_t removed, size_t failed) {
+    shmseg_t *shmseg = shared->shmseg;
+
+    __atomic_fetch_add(&(shmseg->evicted), removed, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&(shmseg->evictfailures), failed, __ATOMIC_RELAXED);
+    __atomic_fetch_sub(&(shmseg->evicting), removed + failed, 
+                       __ATOMIC_RELAXED);
+    events_notify(shared);
+}
+
+int evictworker_missing(shared_t *shared) {
+    pid_t worker=0;
+
+    if ((shared == NULL) || (shared->shmseg == NULL))
+        return 0;
+    worker = ATOMIC_GET(&(shared->shmseg->evictworker));
+    if ((worker > 0) && ((kill(worker, 0) == 0) || (errno == EPERM)))
+        return 0; /* alive */
+    return 1;
+}
+
+int evictworker_register(shared_t *shared) {
+    int result=0;
+
+    lock_shared(shared);
+    if (evictworker_missing(shared) == 1) {
+        __atomic_store_n(&(shared->shmseg->evictworker), getpid(),
+                         __ATOMIC_RELEASE);
+        result = 1;
+    }
+    unlock_shared(shared);
+    return result;
+}
+
+int evictworker_registered(shared_t *shared) {
+    return (ATOMIC_GET(&(shared->shmseg->evictworker)) == getpid());
+}
+
+void evictworker_stop(shared_t *shared) {
+    if ((shared == NULL) || (shared->shmseg == NULL))
+        return;
+    __atomic_store_n(&(shared->shmseg->evictworker), 0, __ATOMIC_RELEASE);
+    sem_post(&(shared->shmseg->evictwake)); /* wake it to notice */
+}
+
+void get_evictstats(shared_t *shared, evictstats_t *evictstats) {
+    memset(evictstats, 0, sizeof(evictstats_t));
+    if ((shared == NULL) || (shared->shmseg == NULL))
+        return;
+    evictstats->evictworker = ATOMIC_GET(&(shared->shmseg->evictworker));
+    evictstats->evictcount = ATOMIC_GET(&(shared->shmseg->evictcount));
+    evictstats->evicting = ATOMIC_GET(&(shared->shmseg->evicting));
+    evictstats->evicted = ATOMIC_GET(&(shared->shmseg->evicted));
+    evictstats->evictfailures = ATOMIC_GET(&(shared->shmseg->evictfailures));
+    evictstats->quotaoverruns = ATOMIC_GET(&(shared->shmseg->quotaoverruns));
+    evictstats->sparecount = ATOMIC_GET(&(shared->shmseg->sparecount));
+    evictstats->recycled = ATOMIC_GET(&(shared->shmseg->recycled));
+}
+
+void events_register(shared_t *shared, int on) {
+    if ((shared == NULL) || (shared->shmseg == NULL))
+        return;
+    /* a previous watcher may have died with a post pending */
+    __atomic_store_n(&(shared->shmseg->eventpending), 0, __ATOMIC_SEQ_CST);
+    ATOMIC_SET(&(shared->shmseg->eventwatcher), (on == 1) ? getpid() : 0);
+}
+
+void events_notify(shared_t *shared) {
+    if ((shared == NULL) || (shared->shmseg == NULL))
+        return;
+    /* Ordered against generation_wait() counting itself then checking
+       generation, so either it sees the bump or we see it waiting */
+    __atomic_add_fetch(&(shared->shmseg->generation), 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&(shared->shmseg->watchers), __ATOMIC_SEQ_CST) > 0)
+        syscall(SYS_futex, &(shared->shmseg->generation), FUTEX_WAKE,
+                INT_MAX, NULL, NULL, 0);
+    /* only the first event since the watcher woke posts, the rest are
+       seen when it reads the counters, so posts don't pile up */
+    if ((ATOMIC_GET(&(shared->shmseg->eventwatcher)) != 0) &&
+        (__atomic_exchange_n(&(shared->shmseg->eventpending), 1,
+                             __ATOMIC_SEQ_CST) == 0))
+        sem_post(&(shared->shmseg->eventwake));
+}
+
+unsigned int get_generation(shared_t *shared) {
+    if ((shared == NULL) || (shared->shmseg == NULL))
+        return 0;
+    return ATOMIC_GET(&(shared->shmseg->generation));
+}
+
+int generation_wait(shared_t *shared, unsigned int seen, int seconds) {
+    struct timespec timeout = { seconds, 0 };
+    unsigned int *generation = &(shared->shmseg->generation);
+
+    __atomic_add_fetch(&(shared->shmseg->watchers), 1, __ATOMIC_SEQ_CST);
+    /* kernel rechecks generation == seen before sleeping */
+    if (__atomic_load_n(generation, __ATOMIC_SEQ_CST) == seen)
+        syscall(SYS_futex, generation, FUTEX_WAIT, seen, &timeout, NULL, 0);
+    __atomic_sub_fetch(&(shared->shmseg->watchers), 1, __ATOMIC_SEQ_CST);
+    return (ATOMIC_GET(generation) != seen);
+}
+
+int events_wait(shared_t *shared, int seconds) {
+    struct timespec deadline;
+
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += seconds;
+    if (sem_timedwait(&(shared->shmseg->eventwake), &deadline) != 0)
+        return 0; /* timeout or signal */
+    /* before the caller reads anything, so a later event posts again */
+    __atomic_store_n(&(shared->shmseg->eventpending), 0, __ATOMIC_SEQ_CST);
+    return 1;
+}
+
+void count_execution(shared_t *shared, int wrapped) {
+    if ((shared == NULL) || (shared->shmseg == NULL))
+        return;
+    if (wrapped == 1)
+        ATOMIC_INC(&(shared->shmseg->wrappedexecutions));
+    else
+        ATOMIC_INC(&(shared->shmseg->unwrappedexecutions));
+}
+
+void record_latency(shared_t *shared, int wrapped, unsigned long usec) {
+    if ((shared == NULL) || (shared->shmseg == NULL))
+        return;
+    if (wrapped == 1)
+        histogram_record(&(shared->shmseg->wrappedlatency), usec);
+    else
+        histogram_record(&(shared->shmseg->unwrappedlatency), usec);
+}
+
+void get_latency(shared_t *shared, int wrapped, histogram_t *histogram) {
+    memset(histogram, 0, sizeof(histogram_t));
+    if ((shared == NULL) || (shared->shmseg == NULL))
+        return;
+    if (wrapped == 1)
+        histogram_copy(&(shared->shmseg->wrappedlatency), histogram);
+    else
+        histogram_copy(&(shared->shmseg->unwrappedlatency), histogram);
+}
+
+void record_usage(shared_t *shared, int wrapped, const unsigned long *values) {
+    usage_t *usage=NULL;
+    unsigned long max=0;
+    size_t field=0;
+
+    if ((shared == NULL) || (shared->shmseg == NULL))
+        return;
+    if (wrapped == 1)
+        usage = &(shared->shmseg->wrappedusage);
+    else
+        usage = &(shared->shmseg->unwrappedusage);
+    for (; field < USAGE_FIELDS; field++) {
+        ATOMIC_ADD(&(usage->total[field]), values[field]);
+        max = __atomic_load_n(&(usage->max[field]), __ATOMIC_RELAXED);
+        while ((values[field] > max) &&
+               (__atomic_compare_exchange_n(&(usage->max[field]), &max, 
+                                            values[field], 0,
+                                            __ATOMIC_RELAXED,
+                                            __ATOMIC_RELAXED) == 0))
+            continue; /* max was reloaded by failed exchange */
+    }
+    /* runs last, so readers never see a run without it's totals */
+    __atomic_fetch_add(&(usage->runs), 1, __ATOMIC_RELEASE);
+}
+
+void get_usage(shared_t *shared, int wrapped, usage_t *usage) {
+    usage_t *source=NULL;
+    size_t field=0;
+
+    memset(usage, 0, sizeof(usage_t));
+    if ((shared == NULL) || (shared->shmseg == NULL))
+        return;
+    if (wrapped == 1)
+        source = &(shared->shmseg->wrappedusage);
+    else
+        source = &(shared->shmseg->unwrappedusage);
+    usage->runs = ATOMIC_GET(&(source->runs));
+    for (; field < USAGE_FIELDS; field++) {
+        usage->total[field] = __atomic_load_n(&(source->total[field]),
+                                              __ATOMIC_RELAXED);
+        usage->max[field] = __atomic_load_n(&(source->max[field]),
+                                            __ATOMIC_RELAXED);
+    }
+}
+
+void get_counters(shared_t *shared, counters_t *counters) {
+    counters_t previous;
+    int tries=0;
+
+    memset(counters, 0, sizeof(counters_t));
+    if ((shared == NULL) || (shared->shmseg == NULL))
+        return;
+    /* Re-read until two passes agree, so no increment lands between
+       reading one counter and the next.  Under constant load settle for
+       the last pass rather than spinning forever. */
+    do {
+        memcpy(&previous, counters, sizeof(counters_t));
+        counters->wrappedexecutions = 
+            ATOMIC_GET(&(shared->shmseg->wrappedexecutions));
+        counters->unwrappedexecutions = 
+            ATOMIC_GET(&(shared->shmseg->unwrappedexecutions));
+        counters->begins = ATOMIC_GET(&(shared->shmseg->begins));
+        counters->ends = ATOMIC_GET(&(shared->shmseg->ends));
+        counters->sampledout = ATOMIC_GET(&(shared->shmseg->sampledout));
+        counters->inflight = ATOMIC_GET(&(shared->shmseg->inflight));
+        counters->inflightpeak = ATOMIC_GET(&(shared->shmseg->inflightpeak));
+        counters->demoted = ATOMIC_GET(&(shared->shmseg->demoted));
+        counters->totalbytes = ATOMIC_GET(&(shared->shmseg->totalbytes));
+        counters->lockrecoveries = 
+            ATOMIC_GET(&(shared->shmseg->lockrecoveries));
+        counters->triggers = ATOMIC_GET(&(shared->shmseg->triggers));
+        counters->recorded = ATOMIC_GET(&(shared->shmseg->recorded));
+        tries++;
+    } while ( (tries < 2) || 
+              ((memcmp(&previous, counters, sizeof(counters_t)) != 0) &&
+               (tries < COUNTERSNAPTRIES)) );
+}
+
+void get_config(shared_t *shared, config_t *config) {
+    unsigned long tries=0;
+    unsigned long before=0;
+    unsigned long after=0;
+
+    memset(config, 0, sizeof(config_t));
+    if ((shared == NULL) || (shared->shmseg == NULL))
+        return;
+    do {
+        before = ATOMIC_GET(&(shared->shmseg->sequence));
+        if ((before & 1) != 0) { /* writer in progress, try again */
+            tries = __seqlock_wait(shared, tries);
+            continue;
+        }
+        config->tracing = shared->shmseg->tracing;
+        memcpy(&(config->sample), &(shared->shmseg->sample), sizeof(sample_t));
+        config->maxconcurrent = shared->shmseg->maxconcurrent;
+        config->maxbytes = shared->shmseg->maxbytes;
+        config->windowid = shared->shmseg->windowid;
+        config->windowdeadline = shared->shmseg->windowdeadline;
+        config->windowruns = shared->shmseg->windowruns;
+        config->windowall = shared->shmseg->windowall;
+        config->compress = shared->shmseg->compress;
+        config->recordbytes = shared->shmseg->recordbytes;
+        config->recordslower = shared->shmseg->recordslower;
+        config->arenasegsize = shared->shmseg->arenasegsize;
+        config->arenasegments = shared->shmseg->arenasegments;
+        config->recycle = shared->shmseg->recycle;
+        memcpy(config->recyclekeep, shared->shmseg->recyclekeep, 
+               MAXDIRSTRLEN);
+        config->keep = shared->shmseg->keep;
+        memcpy(config->outdir, OUTDIRP(shared), MAXDIRSTRLEN);
+        memcpy(config->wrapper, WRAPPERP(shared), MAXCOMMANDLEN);
+        /* copies must complete before sequence is checked again */
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        after = __atomic_load_n(&(shared->shmseg->sequence), __ATOMIC_RELAXED);
+    } while ( ((before & 1) != 0) || (before != after) );
+    /* guarantee null terminators */
+    config->outdir[MAXDIRSTRLEN - 1] = '\0';
+    config->recyclekeep[MAXDIRSTRLEN - 1] = '\0';
+    config->wrapper[MAXCOMMANDLEN - 1] = '\0';
+}
+
+unsigned long get_logring(shared_t *shared, logentry_t **entries) {
+    logentry_t *copy=NULL;
+    unsigned long before=0;
+    unsigned long after=0;
+    unsigned long head=0;
+    unsigned long count=0;
+    unsigned long counter=0;
+    unsigned long tries=0;
+
+    *entries = NULL;
+    if ((shared == NULL) || (shared->shmseg == NULL) || 
+        (LOGRINGLEN(shared) == 0))
+        return 0;
+    copy = malloc(LOGRINGLEN(shared) * sizeof(logentry_t));
+    do {
+        before = ATOMIC_GET(&(shared->shmseg->logsequence));
+        if ((before & 1) != 0) { /* roll in progress, try again */
+            tries = __seqlock_wait(shared, tries);
+            continue;
+        }
+        head = shared->shmseg->head % LOGRINGLEN(shared);
+        count = shared->shmseg->count;
+        if (count > LOGRINGLEN(shared))
+            count = LOGRINGLEN(shared); /* torn, checked below */
+        for (counter = 0; counter < count; counter++)
+            memcpy(&(copy[counter]), 
+                   LOGRINGP(shared) + ((head + counter) % LOGRINGLEN(shared)),
+                   sizeof(logentry_t));
+        /* copies must complete before sequence is checked again */
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        after = __atomic_load_n(&(shared->shmseg->logsequence), 
+                                __ATOMIC_RELAXED);
+    } while ( ((before & 1) != 0) || (before != after) );
+    for (counter = 0; counter < count; counter++)
+        copy[counter].path[MAXDIRSTRLEN - 1] = '\0';
+    *entries = copy;
+    return count;
+}
+
+void set_sampling(shared_t *shared, const sample_t *sample) {
+    if (shared != NULL) {
+        __config_write_begin(shared->shmseg);
+        memcpy(&(shared->shmseg->sample), sample, sizeof(sample_t));
+        __config_write_end(shared->shmseg);
+    }
+}
+
+int sample_execution(shared_t *shared, const config_t *config) {
+    shmseg_t *shmseg = shared->shmseg;
+    unsigned short xsubi[3];
+    struct timespec now;
+    unsigned long nsec=0;
+    unsigned long interval=0;
+    unsigned long tat=0;
+    unsigned long newtat=0;
+    int wrap=1;
+
+    if (config->windowall == 1)
+        return 1; /* --arm trigger, sampling is for --begin's windows */
+    switch (config->sample.policy) {
+        case SAMPLE_EVERY:
+            wrap = ((__atomic_fetch_add(&(shmseg->samplecount), 1,
+                                        __ATOMIC_RELAXED) %
+                     config->sample.every) == 0);
+            break;
+        case SAMPLE_PROBABILITY:
+            /* one draw per process, seed only needs to differ per process */
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            xsubi[0] = (unsigned short) getpid();
+            xsubi[1] = (unsigned short) now.tv_nsec;
+            xsubi[2] = (unsigned short) (now.tv_nsec >> 16);
+            wrap = (erand48(xsubi) < config->sample.probability);
+            break;
+        case SAMPLE_RATE:
+            /* Token bucket as a single word (GCRA): tat is when the bucket
+               will be full again, each wrapped run pushes it one interval
+               further.  Allow a burst of up to rate runs per second. */
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            nsec = (now.tv_sec * NSEC_PER_SEC) + now.tv_nsec;
+            interval = NSEC_PER_SEC / config->sample.rate;
+            tat = __atomic_load_n(&(shmseg->sampletat), __ATOMIC_RELAXED);
+            do {
+                newtat = (tat < nsec) ? nsec : tat; /* full if in past */
+                if ((newtat - nsec) > (interval * (config->sample.rate - 1))) {
+                    wrap = 0; /* bucket is empty */
+                    break;
+                }
+                newtat += interval;
+            } while (__atomic_compare_exchange_n(&(shmseg->sampletat), &tat,
+                                                 newtat, 0, __ATOMIC_RELAXED,
+                                                 __ATOMIC_RELAXED) == 0);
+            break;
+        default: /* SAMPLE_ALL */
+            wrap = 1;
+    }
+    if (wrap == 0)
+        ATOMIC_INC(&(shmseg->sampledout));
+    return wrap;
+}
+
+void set_compress(shared_t *shared, int compress) {
+    if (shared != NULL) {
+        __config_write_begin(shared->shmseg);
+        shared->shmseg->compress = compress;
+        __config_write_end(shared->shmseg);
+    }
+}
+
+void set_record(shared_t *shared, unsigned long bytes, 
+                unsigned long slowerthan) {
+    if (shared != NULL) {
+        __config_write_begin(shared->shmseg);
+        shared->shmseg->recordbytes = bytes;
+        shared->shmseg->recordslower = slowerthan;
+        __config_write_end(shared->shmseg);
+    }
+}
+
+void count_recorded(shared_t *shared) {
+    if ((shared != NULL) && (shared->shmseg != NULL))
+        ATOMIC_INC(&(shared->shmseg->recorded));
+}
+
+void set_arena(shared_t *shared, unsigned long segsize, 
+               unsigned long segments) {
+    if (shared != NULL) {
+        __config_write_begin(shared->shmseg);
+        shared->shmseg->arenasegsize = segsize;
+        shared->shmseg->arenasegments = segments;
+        __config_write_end(shared->shmseg);
+    }
+}
+
+unsigned long arena_next(shared_t *shared) {
+    return __atomic_add_fetch(&(shared->shmseg->arenanext), 1, 
+                              __ATOMIC_RELAXED);
+}
+
+int arena_logged(shared_t *shared, unsigned long sequence,
+                 unsigned long segments) {
+    const logentry_t *entry=NULL;
+    unsigned long before=0;
+    unsigned long after=0;
+    unsigned long head=0;
+    unsigned long count=0;
+    unsigned long counter=0;
+    unsigned long tries=0;
+    int logged=0;
+
+    if ((segments == 0) || (LOGRINGLEN(shared) == 0))
+        return 0;
+    do { /* only arenaseq is read, no copies */
+        before = ATOMIC_GET(&(shared->shmseg->logsequence));
+        if ((before & 1) != 0) { /* roll in progress, try again */
+            tries = __seqlock_wait(shared, tries);
+            continue;
+        }
+        logged = 0;
+        head = shared->shmseg->head % LOGRINGLEN(shared);
+        count = shared->shmseg->count;
+        if (count > LOGRINGLEN(shared))
+            count = LOGRINGLEN(shared); /* torn, checked below */
+        for (counter = 0; (logged == 0) && (counter < count); counter++) {
+            entry = LOGRINGP(shared) + ((head + counter) % LOGRINGLEN(shared));
+            logged = ((entry->arenaseq != 0) &&
+                      ((entry->arenaseq % segments) == (sequence % segments)));
+        }
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        after = __atomic_load_n(&(shared->shmseg->logsequence), 
+                                __ATOMIC_RELAXED);
+    } while ( ((before & 1) != 0) || (before != after) );
+    return logged;
+}
+
+void count_demoted(shared_t *shared) {
+    if ((shared != NULL) && (shared->shmseg != NULL))
+        ATOMIC_INC(&(shared->shmseg->demoted));
+}
+
+void set_recycle(shared_t *shared, int recycle, const char const *keep) {
+    if (shared != NULL) {
+        __config_write_begin(shared->shmseg);
+        shared->shmseg->recycle = recycle;
+        memset(shared->shmseg->recyclekeep, 0, MAXDIRSTRLEN);
+        if (keep != NULL) /* guarantee null terminator */
+            strncpy(shared->shmseg->recyclekeep, keep, MAXDIRSTRLEN - 1);
+        __config_write_end(shared->shmseg);
+    }
+}
+
+unsigned long spare_next(shared_t *shared) {
+    return __atomic_add_fetch(&(shared->shmseg->sparenext), 1, 
+                              __ATOMIC_RELAXED);
+}
+
+int spare_push(shared_t *shared, const char const *spare) {
+    shmseg_t *shmseg = shared->shmseg;
+    char *slot=NULL;
+    int result=1;
+
+    lock_shared(shared);
+    if (shmseg->sparecount < SPAREQUEUELEN) {
+        slot = shmseg->sparequeue[(shmseg->sparehead + shmseg->sparecount) %
+                                  SPAREQUEUELEN];
+        strncpy(slot, spare, MAXDIRSTRLEN - 1);
+        slot[MAXDIRSTRLEN - 1] = '\0';
+        ATOMIC_INC(&(shmseg->sparecount)); /* read unlocked by spare_pop */
+        result = 0;
+    }
+    unlock_shared(shared);
+    return result;
+}
+
+char *spare_pop(shared_t *shared) {
+    shmseg_t *shmseg = shared->shmseg;
+    char *spare=NULL;
+
+    /* common case of recycling off, or worker behind, takes no lock */
+    if (ATOMIC_GET(&(shmseg->sparecount)) == 0)
+        return NULL;
+    lock_shared(shared);
+    if (shmseg->sparecount > 0) {
+        spare = utility_strcpy(shmseg->sparequeue[shmseg->sparehead]);
+        shmseg->sparehead = (shmseg->sparehead + 1) % SPAREQUEUELEN;
+        ATOMIC_SUB(&(shmseg->sparecount), 1);
+    }
+    unlock_shared(shared);
+    return spare;
+}
+
+void count_recycled(shared_t *shared) {
+    if ((shared != NULL) && (shared->shmseg != NULL))
+        ATOMIC_INC(&(shared->shmseg->recycled));
+}
+
+void set_maxbytes(shared_t *shared, unsigned long maxbytes) {
+    if (shared != NULL) {
+        __config_write_begin(shared->shmseg);
+        shared->shmseg->maxbytes = maxbytes;
+        __config_write_end(shared->shmseg);
+    }
+}
+
+void set_maxconcurrent(shared_t *shared, unsigned long maxconcurrent) {
+    if (shared != NULL) {
+        if (maxconcurrent > MAXINFLIGHT)
+            maxconcurrent = MAXINFLIGHT;
+        __config_write_begin(shared->shmseg);
+        shared->shmseg->maxconcurrent = maxconcurrent;
+        __config_write_end(shared->shmseg);
+    }
+}
+
+int inflight_acquire(shared_t *shared, const config_t *config) {
+    shmseg_t *shmseg = shared->shmseg;
+    unsigned long inflight=0;
+    unsigned long peak=0;
+    int slot=-1;
+
+    /* count first, so a reclaim of our slot never finds it uncounted */
+    inflight = __atomic_add_fetch(&(shmseg->inflight), 1, __ATOMIC_RELAXED);
+    if (config->maxconcurrent == 0) { /* never demoted, only counted */
+        slot = __inflight_claim(shmseg, MAXINFLIGHT);
+        if (slot < 0)
+            slot = INFLIGHT_UNSLOTTED;
+    } else {
+        slot = __inflight_claim(shmseg, config->maxconcurrent);
+        /* A killed holder can't release, take back it's slot */
+        if ((slot < 0) && 
+            (__inflight_reclaim(shmseg, config->maxconcurrent) > 0))
+            slot = __inflight_claim(shmseg, config->maxconcurrent);
+        if (slot < 0) {
+            __atomic_fetch_sub(&(shmseg->inflight), 1, __ATOMIC_RELAXED);
+            ATOMIC_INC(&(shmseg->demoted));
+            return -1;
+        }
+        if (inflight > config->maxconcurrent) /* others still trying */
+            inflight = config->maxconcurrent;
+    }
+    peak = __atomic_load_n(&(shmseg->inflightpeak), __ATOMIC_RELAXED);
+    while ((inflight > peak) &&
+           (__atomic_compare_exchange_n(&(shmseg->inflightpeak), &peak,
+                                        inflight, 0, __ATOMIC_RELAXED,
+                                        __ATOMIC_RELAXED) == 0))
+        continue; /* peak was reloaded by failed exchange */
+    return slot;
+}
+
+int inflight_reclaim(shared_t *shared) {
+    if ((shared == NULL) || (shared->shmseg == NULL))
+        return 0;
+    return __inflight_reclaim(shared->shmseg, MAXINFLIGHT);
+}
+
+void inflight_release(shared_t *shared, int slot) {
+    pid_t mypid = getpid();
+
+    if ((shared == NULL) || (slot < 0) || (slot > INFLIGHT_UNSLOTTED))
+        return;
+    if (slot == INFLIGHT_UNSLOTTED) {
+        __atomic_fetch_sub(&(shared->shmseg->inflight), 1, __ATOMIC_RELAXED);
+        return;
+    }
+    /* might have been reclaimed if pid was wrongly thought dead */
+    if (__atomic_compare_exchange_n(&(shared->shmseg->inflightpids[slot]),
+                                    &mypid, 0, 0,
+                                    __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+        __atomic_fetch_sub(&(shared->shmseg->inflight), 1, __ATOMIC_RELAXED);
+}
+
+void set_window(shared_t *shared, unsigned long seconds, unsigned long runs,
+                int all) {
+    shmseg_t *shmseg=NULL;
+
+    if (shared == NULL)
+        return;
+    shmseg = shared->shmseg;
+    __config_write_begin(shmseg);
+    if ((seconds == 0) && (runs == 0))
+        ATOMIC_SET(&(shmseg->windowid), 0);
+    else /* odd while writing, so never 0 and never reused */
+        ATOMIC_SET(&(shmseg->windowid), shmseg->sequence);
+    shmseg->windowdeadline = 0;
+    if (seconds > 0)
+        shmseg->windowdeadline = __monotonic_ns() + 
+                                 (seconds * 1000000000UL);
+    shmseg->windowruns = runs;
+    shmseg->windowall = all;
+    ATOMIC_SET(&(shmseg->windowleft), runs);
+    __config_write_end(shmseg);
+}
+
+int window_claim(shared_t *shared, const config_t *config) {
+    unsigned long left=0;
+
+    if (config->windowid == 0)
+        return 1; /* unbounded */
+    if ((config->windowdeadline != 0) &&
+        (__monotonic_ns() >= config->windowdeadline)) {
+        __window_close(shared, config->windowid);
+        return 0;
+    }
+    if (config->windowruns == 0)
+        return 1;
+    left = __atomic_fetch_sub(&(shared->shmseg->windowleft), 1, 
+                              __ATOMIC_RELAXED);
+    if ((long) left <= 0) { /* lost the race for the last run */
+        __window_close(shared, config->windowid);
+        return 0;
+    }
+    if (left == 1) /* claimed the last run, nobody else should wrap */
+        __window_close(shared, config->windowid);
+    return 1;
+}
+
+void get_windowleft(shared_t *shared, const config_t *config,
+                    unsigned long *seconds, unsigned long *runs) {
+    unsigned long now=0;
+    long left=0;
+
+    *seconds = 0;
+    *runs = 0;
+    if ((shared == NULL) || (config->windowid == 0))
+        return;
+    now = __monotonic_ns();
+    if (config->windowdeadline > now) /* round up, 0 means over */
+        *seconds = (config->windowdeadline - now + 999999999UL) / 
+                   1000000000UL;
+    left = (long) ATOMIC_GET(&(shared->shmseg->windowleft));
+    if ((config->windowruns != 0) && (left > 0))
+        *runs = left;
+}
+
+void set_arm(shared_t *shared, const arm_t *arm) {
+    if (shared == NULL)
+        return;
+    __config_write_begin(shared->shmseg);
+    memcpy(&(shared->shmseg->arm), arm, sizeof(arm_t));
+    ATOMIC_SET(&(shared->shmseg->armnext), 0); /* no cooldown yet */
+    __config_write_end(shared->shmseg);
+}
+
+void get_arm(shared_t *shared, arm_t *arm) {
+    unsigned long tries=0;
+    unsigned long before=0;
+    unsigned long after=0;
+
+    memset(arm, 0, sizeof(arm_t));
+    if ((shared == NULL) || (shared->shmseg == NULL))
+        return;
+    do {
+        before = ATOMIC_GET(&(shared->shmseg->sequence));
+        if ((before & 1) != 0) { /* writer in progress, try again */
+            tries = __seqlock_wait(shared, tries);
+            continue;
+        }
+        memcpy(arm, &(shared->shmseg->arm), sizeof(arm_t));
+        /* copy must complete before sequence is checked again */
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        after = __atomic_load_n(&(shared->shmseg->sequence), __ATOMIC_RELAXED);
+    } while ( ((before & 1) != 0) || (before != after) );
+}
+
+int anomaly_check(shared_t *shared, int failed, unsigned long usec) {
+    arm_t arm;
+    unsigned long now=0;
+    unsigned long next=0;
+    int triggered=0;
+
+    if ((shared == NULL) || (shared->shmseg == NULL) ||
+        (__atomic_load_n(&(shared->shmseg->arm.armed), 
+                         __ATOMIC_RELAXED) == 0))
+        return 0; /* all unarmed executions pay */
+    get_arm(shared, &arm);
+    if ((arm.armed == 0) ||
+        (((arm.onfailure == 0) || (failed == 0)) &&
+         ((arm.slowerthan == 0) || (usec <= arm.slowerthan))))
+        return 0;
+    now = __monotonic_ns();
+    next = ATOMIC_GET(&(shared->shmseg->armnext));
+    /* only one crossing per cooldown gets past the exchange */
+    if ((now < next) ||
+        (__atomic_compare_exchange_n(&(shared->shmseg->armnext), &next,
+                                     now + (arm.cooldown * 1000000000UL), 0,
+                                     __ATOMIC_RELAXED, 
+                                     __ATOMIC_RELAXED) == 0))
+        return 0;
+    lock_shared(shared);
+    /* never cut short or take over wrapping someone began by hand */
+    if ((shared->shmseg->arm.armed == 1) && (get_tracing(shared) == 0)) {
+        /* the next runs, not whatever an old --begin sampled from them,
+           but that sampling stays for the next --begin */
+        set_window(shared, 0, arm.runs, 1);
+        set_tracing(shared);
+        ATOMIC_INC(&(shared->shmseg->triggers));
+        triggered = 1;
+    }
+    unlock_shared(shared);
+    return triggered;
+}
+
 void set_tracing(shared_t *shared) {
     if (shared != NULL) {
+        __config_write_begin(shared->shmseg);
         shared->shmseg->tracing = 1;
-        shared->shmseg->begins += 1;
+        __config_write_end(shared->shmseg);
+        ATOMIC_INC(&(shared->shmseg->begins));
+        events_notify(shared);
     }
 }
 
 void unset_tracing(shared_t *shared) {
     if (shared != NULL) {
+        __config_write_begin(shared->shmseg);
         shared->shmseg->tracing = 0;
-        shared->shmseg->ends += 1;
+        ATOMIC_SET(&(shared->shmseg->windowid), 0);
+        __config_write_end(shared->shmseg);
+        ATOMIC_INC(&(shared->shmseg->ends));
+        events_notify(shared);
     }
 }
 
 int get_tracing(shared_t *shared) {
     if ((shared == NULL) || 
         (shared->shmseg == NULL) || 
-        (shared->shmseg->tracing == 0))
+        (ATOMIC_GET(&(shared->shmseg->tracing)) == 0))
         return 0;
     else
         return 1;
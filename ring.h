@@ -28,75 +28,473 @@
                             possible directory name*/
 #define MAXCOMMANDLEN 1024 /* characters needed for longest 
                               possible command line */
+#define EVICTQUEUELEN 64 /* evicted logring entries awaiting removal */
+#define SPAREQUEUELEN 16 /* emptied directories awaiting reuse */
+#define SPAREPREFIX ".spare-" /* names spare directories in outdir */
+#define MAXINFLIGHT 1024 /* highest possible max concurrent wrapped runs */
+#define INFLIGHT_UNSLOTTED MAXINFLIGHT /* counted in-flight without a slot */
 
 /**************************************************
 ********************* TYPES
 **************************************************/
 
+typedef struct logentry_s {
+    char path[MAXDIRSTRLEN]; /* output directory of one run */
+    unsigned long bytes; /* size of files under path after the run */
+    unsigned long arenaseq; /* arena sequence holding the run's output
+                               until extracted to path, 0 = path is a 
+                               directory */
+} logentry_t;
+
+typedef enum sampling_e {
+    SAMPLE_ALL, /* wrap every execution while tracing */
+    SAMPLE_EVERY, /* wrap every Nth execution */
+    SAMPLE_PROBABILITY, /* wrap executions at random */
+    SAMPLE_RATE, /* wrap at most N executions per second */
+} sampling_t;
+
+typedef struct sample_s {
+    sampling_t policy;
+    unsigned long every; /* N for SAMPLE_EVERY */
+    double probability; /* 0.0 - 1.0 for SAMPLE_PROBABILITY */
+    unsigned long rate; /* N for SAMPLE_RATE */
+} sample_t;
+
+typedef enum usagefield_e {
+    USAGE_UTIME, /* user CPU microseconds */
+    USAGE_STIME, /* system CPU microseconds */
+    USAGE_MAXRSS, /* peak resident set KiB */
+    USAGE_NVCSW, /* voluntary context switches */
+    USAGE_NIVCSW, /* involuntary context switches */
+    USAGE_INBLOCK, /* block input operations */
+    USAGE_OUBLOCK, /* block output operations */
+    USAGE_FIELDS, /* number of fields above */
+} usagefield_t;
+
+/* resources used by executions, as reaped by wait4(), only modified
+   atomically */
+typedef struct usage_s {
+    unsigned long runs; /* executions accounted */
+    unsigned long total[USAGE_FIELDS]; /* sum over all runs */
+    unsigned long max[USAGE_FIELDS]; /* highest of any one run */
+} usage_t;
+
+typedef struct arm_s {
+    int armed; /* 1 = unwrapped executions are checked against below */
+    int onfailure; /* 1 = a non-zero exit or killing signal triggers */
+    unsigned long slowerthan; /* microseconds that trigger or 0 = none */
+    unsigned long runs; /* wrapped executions after each trigger */
+    unsigned long cooldown; /* seconds after a trigger before the next */
+} arm_t;
+
 typedef struct shmseg_s {
+    int ready; /* set once creator finished initializing lock */
+    pthread_mutex_t lock; /* robust and process shared, see lock_shared() */
+    unsigned long lockrecoveries; /* times a dead holder's lock was taken */
+    /* odd while tracing, sample, outdir or wrapper are being written,
+       bumped twice per write.  Lets readers copy them without locking */
+    unsigned long sequence;
     int tracing; /* 0 = not tracing; 1 = tracing; */
+    sample_t sample; /* which executions to wrap while tracing */
+    unsigned long samplecount; /* executions considered for SAMPLE_EVERY */
+    unsigned long sampletat; /* SAMPLE_RATE theoretical arrival time, ns */
+    unsigned long sampledout; /* executions not wrapped due to sample */
+    unsigned long maxconcurrent; /* wrapped runs at once or 0 for no cap */
+    unsigned long inflight; /* wrapped runs now, slotted or not */
+    unsigned long inflightpeak; /* highest inflight ever seen */
+    unsigned long demoted; /* not wrapped due to maxconcurrent or arena */
+    /* bounded tracing window, written like tracing.  windowid is the
+       odd sequence it was opened under, or 0 while unbounded */
+    unsigned long windowid;
+    unsigned long windowdeadline; /* CLOCK_MONOTONIC ns or 0 = none */
+    unsigned long windowruns; /* wrapped runs it allows or 0 = no limit */
+    unsigned long windowleft; /* of windowruns, only modified atomically */
+    int windowall; /* 1 = window wraps every execution, sample ignored */
+    arm_t arm; /* anomaly trigger, written like tracing */
+    unsigned long armnext; /* CLOCK_MONOTONIC ns cooldown ends, atomic */
+    unsigned long triggers; /* times arm switched tracing on, atomic */
+    pid_t inflightpids[MAXINFLIGHT]; /* slot holders, 0 = free slot */
+    /* counters are only modified atomically, never under lock */
     unsigned long wrappedexecutions;
     unsigned long unwrappedexecutions;
     unsigned long keep;
     unsigned long begins;
     unsigned long ends;
+    time_t created; /* when --init made it */
+    /* odd while logring, head or count are being written, bumped twice
+       per logring_roll() under lock.  Lets readers copy them unlocked */
+    unsigned long logsequence;
+    unsigned long head; /* logring index of oldest entry */
+    unsigned long count; /* number of entries in logring */
+    unsigned long maxbytes; /* evict runs beyond this total bytes, 0=none */
+    unsigned long totalbytes; /* bytes of all logring entries */
+    int compress; /* 1 = @@@ is a fifo drained into a compressed file */
+    unsigned long recordbytes; /* flight recorder per unwrapped run or 0 */
+    unsigned long recordslower; /* also keep recordings over usec or 0 */
+    unsigned long recorded; /* recordings kept in logring, atomic */
+    unsigned long arenasegsize; /* bytes per arena segment or 0 = none */
+    unsigned long arenasegments; /* segments in arena file */
+    unsigned long arenanext; /* last arena sequence handed out, atomic */
+    pid_t evictworker; /* process removing evicted entries or 0 */
+    sem_t evictwake; /* posted for every entry added to evictqueue */
+    unsigned long evicthead; /* evictqueue index of oldest entry */
+    unsigned long evictcount; /* number of entries in evictqueue */
+    unsigned long evicting; /* dequeued but not yet removed, atomic */
+    unsigned long evicted; /* total removed, atomic */
+    unsigned long evictfailures; /* total failed removals, atomic */
+    unsigned long quotaoverruns; /* rolls left over maxbytes, atomic */
+    char evictqueue[EVICTQUEUELEN][MAXDIRSTRLEN]; /* circular, like logring */
+    int recycle; /* 1 = evicted directories are emptied and reused */
+    char recyclekeep[MAXDIRSTRLEN]; /* file truncated, not removed, or "" */
+    unsigned long sparenext; /* last spare number handed out, atomic */
+    unsigned long sparehead; /* sparequeue index of oldest entry */
+    unsigned long sparecount; /* number of entries in sparequeue */
+    unsigned long recycled; /* spares renamed into place, atomic */
+    char sparequeue[SPAREQUEUELEN][MAXDIRSTRLEN]; /* circular, like logring */
+    unsigned int generation; /* futex, bumped by events_notify() */
+    unsigned int watchers; /* processes waiting for generation to change */
+    pid_t eventwatcher; /* ringwrapd process watching this ring or 0 */
+    sem_t eventwake; /* posted once per wakeup while eventwatcher set */
+    unsigned int eventpending; /* eventwake posted, not yet waited, atomic */
+    histogram_t wrappedlatency; /* microseconds per wrapped execute() */
+    histogram_t unwrappedlatency; /* microseconds per unwrapped execute() */
+    usage_t wrappedusage; /* resources used by wrapped executions */
+    usage_t unwrappedusage; /* resources used by unwrapped executions */
     char outdir[MAXDIRSTRLEN];
     char wrapper[MAXCOMMANDLEN];
-    char logring[MAXDIRSTRLEN]; /* shared memory char vector, 
-                                   num_entries tall  */
+    logentry_t logring[1]; /* shared memory circular vector,
+                              keep - 1 entries tall, oldest at head */
 } shmseg_t;
 
+typedef struct config_s {
+    int tracing; /* copy of shmseg->tracing */
+    sample_t sample; /* copy of shmseg->sample */
+    unsigned long maxconcurrent; /* copy of shmseg->maxconcurrent */
+    unsigned long maxbytes; /* copy of shmseg->maxbytes */
+    unsigned long windowid; /* copy of shmseg->windowid */
+    unsigned long windowdeadline; /* copy of shmseg->windowdeadline */
+    unsigned long windowruns; /* copy of shmseg->windowruns */
+    int windowall; /* copy of shmseg->windowall */
+    int compress; /* copy of shmseg->compress */
+    unsigned long recordbytes; /* copy of shmseg->recordbytes */
+    unsigned long recordslower; /* copy of shmseg->recordslower */
+    unsigned long arenasegsize; /* copy of shmseg->arenasegsize */
+    unsigned long arenasegments; /* copy of shmseg->arenasegments */
+    int recycle; /* copy of shmseg->recycle */
+    char recyclekeep[MAXDIRSTRLEN]; /* copy of shmseg->recyclekeep */
+    unsigned long keep; /* copy of shmseg->keep */
+    char outdir[MAXDIRSTRLEN]; /* copy of shmseg->outdir */
+    char wrapper[MAXCOMMANDLEN]; /* copy of shmseg->wrapper */
+} config_t;
+
+typedef struct counters_s {
+    unsigned long wrappedexecutions;
+    unsigned long unwrappedexecutions;
+    unsigned long begins;
+    unsigned long ends;
+    unsigned long sampledout;
+    unsigned long inflight;
+    unsigned long inflightpeak;
+    unsigned long demoted;
+    unsigned long totalbytes;
+    unsigned long lockrecoveries;
+    unsigned long triggers;
+    unsigned long recorded;
+} counters_t;
+
+typedef struct evictstats_s {
+    pid_t evictworker;
+    unsigned long evictcount; /* queue depth */
+    unsigned long evicting; /* being removed by worker */
+    unsigned long evicted;
+    unsigned long evictfailures;
+    unsigned long quotaoverruns; /* rolls the queue was too full to
+                                    bring under maxbytes */
+    unsigned long sparecount; /* emptied directories ready for reuse */
+    unsigned long recycled;
+} evictstats_t;
+
 typedef struct shared_s {
-    char *name; /* name of the shared memory segment & semaphore */
-    sem_t *sem; /* semephore struct if open/needed */
+    char *name; /* name of the shared memory segment */
     shmseg_t *shmseg; /* shared memory segment structure */
+    registry_t *registry; /* registry holding shmseg, or NULL if its own */
+    regslot_t *slot; /* registry slot of shmseg, held until free_shared() */
+    unsigned long slotgeneration; /* of slot when it was held */
 } shared_t;
 
 /**************************************************
 ********************* FUNCTION DEFINITIONS
 **************************************************/
 
-/* Lock / unlock shared data */
+/* Lock / unlock shared data.  Should the previous holder have died
+   while holding the lock, repairs whatever it may have left half
+   written before returning */
 void lock_shared(shared_t *shared);
 void unlock_shared(shared_t *shared);
 
+#ifdef BENCHMARK
+/* returns nanoseconds this process spent waiting in lock_shared() */
+unsigned long lock_waited(void);
+#endif
+
 /* allocates and returns newly initialized shared_t pointer
-   or NULL on failure.  Newly structure returned in LOCKED state. */
+   or NULL on failure.  Newly structure returned in LOCKED state.
+   If registry, it's kept in the registry segment instead of it's own. */
 shared_t *new_shared(unsigned long keep,
                      const char const *outdir,
                      const char const *wrapper,
                      const char const *cmdbasename,
-                     const char const *unique);
+                     const char const *unique,
+                     int registry);
 
 /* allocates and returns shared_t pointer for existing 
-   semaphore and logring or NULL on failure */
+   shared memory segment or NULL on failure */
 shared_t *get_shared(const char const *cmdbasename,
-                     const char const *unique);
+                     const char const *unique,
+                     int registry);
+
+/* same as get_shared() but for ring name as made from cmdbasename and
+   unique, e.g. as printed by --list */
+shared_t *get_shared_byname(const char const *name, int registry);
+
+/* returns 1 if shared data has not been destroyed since it was 
+   attached, otherwise 0 */
+int shared_alive(shared_t *shared);
+
+/* allocates and returns shared_t pointer for the first ring in the
+   registry at or after *index, advancing *index past it.  Returns NULL
+   when there are no more. */
+shared_t *next_shared(unsigned long *index);
+
+/* takes another hold on shared's registry slot, for a forked process
+   outliving the one that attached.  It's free_shared() releases it.
+   Returns 0 on success (always, without --registry), non-zero if the 
+   ring was destroyed or it's slot reused meanwhile */
+int hold_shared(shared_t *shared);
 
 /* closes shared data - DOES NOT DESTROY IT */
 void free_shared(shared_t *shared);
 
-/* locks, then destroys shared memory segment and semaphore */
-void destroy_shared(shared_t *shared);
+/* destroys locked shared memory segment, then unlocks it so no 
+   waiter is stuck on it.  Returns 0 on success, non-zero with errno
+   set if it's still there */
+int destroy_shared(shared_t *shared);
+
+/* returns pointer to index'th oldest entry in logring or NULL
+   if there are not that many entries */
+const logentry_t *logring_index(shared_t *shared, size_t index);
+
+/* If logring vector is full, overwrites oldest entry with newentry
+   and queues the oldest for the eviction worker, returning NULL.  Only if
+   the eviction queue is also full is a copy of the oldest returned for
+   the caller to remove.  Then, while entries total more than maxbytes,
+   queues oldest ones too, always retaining newentry.  With the queue
+   full, one is returned for the caller instead (unless it has one 
+   already) and a roll still left over maxbytes is counted as a quota 
+   overrun.  Entries kept in the arena (arenaseq not 0) are just 
+   dropped. Does own locking. */
+char *logring_roll(shared_t *shared, const char const *newentry,
+                   unsigned long bytes, unsigned long arenaseq);
+
+/* wait up to seconds for evicted entries, then dequeue up to max of them
+   into entries (each must be freed).  Returns number dequeued, they are
+   counted as being evicted until evict_done(). Does own locking. */
+size_t evict_dequeue(shared_t *shared, char **entries, size_t max,
+                     int seconds);
+
+/* account for removal of entries returned by evict_dequeue() */
+void evict_done(shared_t *shared, size_t removed, size_t failed);
+
+/* returns 1 if no live eviction worker is registered, otherwise 0 */
+int evictworker_missing(shared_t *shared);
+
+/* registers calling process as eviction worker, returns 0 if
+   another live worker is already registered. Does own locking. */
+int evictworker_register(shared_t *shared);
+
+/* returns 1 while calling process is still the registered worker */
+int evictworker_registered(shared_t *shared);
+
+/* unregisters any eviction worker, which then drains queue and exits */
+void evictworker_stop(shared_t *shared);
+
+/* fill evictstats with eviction queue and worker state. Requires no
+   locking. */
+void get_evictstats(shared_t *shared, evictstats_t *evictstats);
+
+/* sets (on = 1) or clears calling process as the ring's event watcher */
+void events_register(shared_t *shared, int on);
+
+/* bumps generation and wakes any generation_wait() or event watcher
+   after shared counters or state changed.  Requires no locking. */
+void events_notify(shared_t *shared);
+
+/* returns current generation.  Requires no locking. */
+unsigned int get_generation(shared_t *shared);
+
+/* sleeps until generation is no longer seen, up to seconds or until a
+   signal.  Returns 1 if it changed, otherwise 0. Requires no locking. */
+int generation_wait(shared_t *shared, unsigned int seen, int seconds);
+
+/* waits up to seconds for events_notify(), consuming every pending one
+   so the next call waits for events after this one returned.  Returns 1 
+   if there were any, 0 on timeout. */
+int events_wait(shared_t *shared, int seconds);
+
+/* atomically increment wrapped or unwrapped execution counter.
+   Requires no locking. */
+void count_execution(shared_t *shared, int wrapped);
+
+/* atomically record microseconds an execution took in wrapped or
+   unwrapped latency histogram.  Requires no locking. */
+void record_latency(shared_t *shared, int wrapped, unsigned long usec);
+
+/* copy wrapped or unwrapped latency histogram. Requires no locking. */
+void get_latency(shared_t *shared, int wrapped, histogram_t *histogram);
+
+/* atomically add values (indexed by usagefield_t) of one execution to
+   wrapped or unwrapped totals and maxima.  Requires no locking. */
+void record_usage(shared_t *shared, int wrapped, const unsigned long *values);
+
+/* copy wrapped or unwrapped resource usage. Requires no locking. */
+void get_usage(shared_t *shared, int wrapped, usage_t *usage);
+
+/* fill counters with a consistent snapshot of shared counters.
+   Requires no locking. */
+void get_counters(shared_t *shared, counters_t *counters);
+
+/* fill config with a consistent copy of tracing state and wrapper
+   configuration.  Requires no locking and never blocks on writers. */
+void get_config(shared_t *shared, config_t *config);
+
+/* set sampling policy used while tracing. Requires Locking. */
+void set_sampling(shared_t *shared, const sample_t *sample);
+
+/* returns 1 if this execution should be wrapped according to
+   config->sample, otherwise counts it as sampled out and returns 0. 
+   Requires no locking. */
+int sample_execution(shared_t *shared, const config_t *config);
+
+/* set whether wrapper output is compressed. Requires Locking. */
+void set_compress(shared_t *shared, int compress);
+
+/* set flight recorder size for unwrapped runs, 0 for none, and latency
+   in usec over which recordings of successful runs are kept too, 0 for
+   only failed ones. Requires Locking. */
+void set_record(shared_t *shared, unsigned long bytes, 
+                unsigned long slowerthan);
+
+/* atomically count a kept recording. Requires no locking. */
+void count_recorded(shared_t *shared);
+
+/* set arena segment size and count, 0 for a directory per run.
+   Requires Locking. */
+void set_arena(shared_t *shared, unsigned long segsize, 
+               unsigned long segments);
+
+/* returns next arena sequence, counting from 1. Requires no locking. */
+unsigned long arena_next(shared_t *shared);
+
+/* returns 1 if a logring entry still refers to the arena segment 
+   sequence would be written to, out of segments, else 0.  Requires
+   no locking. */
+int arena_logged(shared_t *shared, unsigned long sequence,
+                 unsigned long segments);
+
+/* atomically count an execution not wrapped for lack of a free arena
+   segment as demoted. Requires no locking. */
+void count_demoted(shared_t *shared);
+
+/* set whether evicted directories are emptied and reused, truncating
+   any file named keep in them rather than removing it.  Requires 
+   Locking. */
+void set_recycle(shared_t *shared, int recycle, const char const *keep);
+
+/* returns next spare directory number, counting from 1. Requires no
+   locking. */
+unsigned long spare_next(shared_t *shared);
+
+/* queues an emptied directory for reuse, returns non-zero if the spare
+   queue is full. Does own locking. */
+int spare_push(shared_t *shared, const char const *spare);
+
+/* returns copy of oldest spare directory, to be freed, or NULL if there
+   are none.  Only locks if there might be one. */
+char *spare_pop(shared_t *shared);
+
+/* atomically count a spare directory renamed into place. Requires no 
+   locking. */
+void count_recycled(shared_t *shared);
+
+/* set byte quota for logring entries, 0 for none.  Takes effect at
+   next logring_roll(). Requires Locking. */
+void set_maxbytes(shared_t *shared, unsigned long maxbytes);
+
+/* set cap on concurrently wrapped runs, 0 for none. Requires Locking. */
+void set_maxconcurrent(shared_t *shared, unsigned long maxconcurrent);
+
+/* counts calling process's wrapped run as in-flight and claims one of
+   config->maxconcurrent in-flight slots for it, returning it's index.
+   Slots of dead processes are reclaimed.  Returns -1 and counts 
+   execution as demoted if all are taken.  Without a cap any free slot
+   is claimed, only so --stats can take back a killed run's count, or
+   INFLIGHT_UNSLOTTED if none is.  Requires no locking. */
+int inflight_acquire(shared_t *shared, const config_t *config);
+
+/* frees in-flight slots of processes that no longer exist, returning 
+   number freed. Requires no locking. */
+int inflight_reclaim(shared_t *shared);
+
+/* releases slot returned by inflight_acquire(), ignoring -1. Requires 
+   no locking. */
+void inflight_release(shared_t *shared, int slot);
+
+/* bounds tracing to seconds and/or runs wrapped executions from now,
+   after which window_claim() ends it.  Both 0 removes any bound.  With
+   all 1, every execution until then is wrapped, leaving the sampling
+   set for later windows as it is.  Requires Locking. */
+void set_window(shared_t *shared, unsigned long seconds, unsigned long runs,
+                int all);
+
+/* returns 1 if this execution may be wrapped within config's window,
+   using up one of it's runs.  Ends tracing, counting it in ends, once
+   the window's deadline passed or it's last run is claimed.  Only
+   locks shared to end it.  Returns 0 if the window already ended. */
+int window_claim(shared_t *shared, const config_t *config);
+
+/* sets *seconds and *runs left in config's window, either 0 if not
+   bounded by it. Requires no locking. */
+void get_windowleft(shared_t *shared, const config_t *config,
+                    unsigned long *seconds, unsigned long *runs);
+
+/* set anomaly trigger, arm->armed = 0 disarms. Requires Locking. */
+void set_arm(shared_t *shared, const arm_t *arm);
 
-/* returns pointer to entry in logring, might be pointing at Null */
-const char *logring_index(shared_t *shared, size_t index);
+/* fill arm with a consistent copy of the anomaly trigger.  Requires
+   no locking. */
+void get_arm(shared_t *shared, arm_t *arm);
 
-/* If logring vector is full, popps off first entry, rotates remaining
-   entries, and returns copy of the first.  If logring vector is not full
-   appends newentry and returns NULL. Does own locking. */
-char *logring_roll(shared_t *shared, const char const *newentry);
+/* checks an unwrapped execution that failed (1) or not (0) and took usec
+   against the anomaly trigger.  When it crosses a threshold outside the
+   cooldown, switches tracing on for the trigger's next runs executions,
+   all wrapped whatever sampling an earlier --begin set, and returns 1,
+   otherwise 0.  Lock free and a single load
+   unless armed, only locks shared to switch tracing on. */
+int anomaly_check(shared_t *shared, int failed, unsigned long usec);
 
 /* set shared->tracing = 1. Requires Locking. */
 void set_tracing(shared_t *shared);
 
-/* set shared->tracing = 0. Requires Locking. */
+/* set shared->tracing = 0, ending any window. Requires Locking. */
 void unset_tracing(shared_t *shared);
 
-/* returns 1 if shared->shmseg->tracing is/was 1 otherwise 0 */
+/* returns 1 if shared->shmseg->tracing is/was 1 otherwise 0.
+   Requires no locking. */
 int get_tracing(shared_t *shared);
 
-/* Retrieve copy of current logring vector */
-char *get_logring_copy(shared_t *shared);
+/* sets *entries to newly allocated consistent copy of logring entries,
+   oldest first, returning how many.  Requires no locking and never 
+   blocks on logring_roll(). */
+unsigned long get_logring(shared_t *shared, logentry_t **entries);
 
 #endif /* _RING_H */
@@ -18,66 +18,388 @@
 #
 */
 
+#include <stdio.h>
 #include <stdlib.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/mman.h>
+#include <fcntl.h>
 #include <unistd.h>
 #include <semaphore.h>
+#include <pthread.h>
 #include <time.h>
 #include <string.h>
 #include <errno.h>
 #include <argp.h>
+#include <signal.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
 #include "version.h"
 #include "utility.h"
+#include "histogram.h"
+#include "registry.h"
 #include "ring.h"
+#include "compress.h"
+#include "recorder.h"
+#include "arena.h"
+#include "evict.h"
 #include "options.h"
+#include "export.h"
 #include "ringwrap.h"
 
+/**************************************************
+********************* GLOBALS
+**************************************************/
+#ifdef BENCHMARK
+bench_t bench; /* phase timings of this invocation */
+#endif
+volatile sig_atomic_t watchstop=0; /* set by SIGINT / SIGTERM in --watch */
+
 /**************************************************
 ********************* FUNCTIONS
 **************************************************/
 
 void print_logring(shared_t *shared) {
     unsigned long counter=0;
-    const char *log;
+    unsigned long count=0;
+    logentry_t *entries=NULL;
+    const logentry_t *log;
 
+    /* copied under the logring seqlock, a concurrent roll can't tear it */
+    count = get_logring(shared, &entries);
     for(;(counter < shared->shmseg->keep - 1) &&
          (counter < 5); counter++) {
-        log = logring_index(shared,counter);
+        log = (counter < count) ? &(entries[counter]) : NULL;
         fprintf(stderr,"%-4lu: ", counter);
-        if ((log == NULL) || (*log == '\0')) {
+        if ((log == NULL) || (log->path[0] == '\0')) {
             fprintf(stderr, "(empty)\n");
             break;
         }
+        else if (log->arenaseq != 0)
+            fprintf(stderr, "%s (%lu bytes, in arena until --extract)\n",
+                    log->path, log->bytes);
         else
-            fprintf(stderr, "%s\n", log);
+            fprintf(stderr, "%s (%lu bytes)\n", log->path, log->bytes);
+    }
+    free(entries);
+}
+
+void print_latency(const char const *label, histogram_t *histogram) {
+    fprintf(stderr, "\t%s: count %lu mean %lu p50 %lu p90 %lu p99 %lu "
+                    "p99.9 %lu max %lu\n", label, histogram->count,
+                    histogram_mean(histogram),
+                    histogram_percentile(histogram, 50.0),
+                    histogram_percentile(histogram, 90.0),
+                    histogram_percentile(histogram, 99.0),
+                    histogram_percentile(histogram, 99.9),
+                    histogram->max);
+}
+
+void print_usage(const char const *label, const usage_t *usage) {
+    static const char const *names[USAGE_FIELDS] = {
+        "User CPU (usec)", "System CPU (usec)", "Max RSS (KiB)",
+        "Voluntary Switches", "Involuntary Switches", "Block Inputs",
+        "Block Outputs" };
+    unsigned long runs=usage->runs;
+    size_t field=0;
+
+    fprintf(stderr, "\t%s: %lu runs\n", label, runs);
+    if (runs == 0)
+        runs = 1; /* all zero anyway */
+    for (; field < USAGE_FIELDS; field++)
+        fprintf(stderr, "\t\t%s: total %lu mean %lu max %lu\n", 
+                names[field], usage->total[field], 
+                usage->total[field] / runs, usage->max[field]);
+}
+
+void print_overhead(const usage_t *wrapped, const usage_t *unwrapped) {
+    long cpu=0;
+    long rss=0;
+
+    if ((wrapped->runs == 0) || (unwrapped->runs == 0))
+        return;
+    cpu = (long) ((wrapped->total[USAGE_UTIME] + 
+                   wrapped->total[USAGE_STIME]) / wrapped->runs) -
+          (long) ((unwrapped->total[USAGE_UTIME] + 
+                   unwrapped->total[USAGE_STIME]) / unwrapped->runs);
+    rss = (long) (wrapped->total[USAGE_MAXRSS] / wrapped->runs) -
+          (long) (unwrapped->total[USAGE_MAXRSS] / unwrapped->runs);
+    fprintf(stderr, "\tWrapper Overhead (mean per run): CPU %+ld usec, "
+                    "Max RSS %+ld KiB\n", cpu, rss);
+}
+
+void print_window(const char const *label, unsigned long seconds,
+                  unsigned long runs) {
+    if ((seconds > 0) && (runs > 0))
+        fprintf(stderr, "%s after %lu seconds or %lu wrapped executions, "
+                        "whichever comes first\n", label, seconds, runs);
+    else if (seconds > 0)
+        fprintf(stderr, "%s after %lu seconds\n", label, seconds);
+    else if (runs > 0)
+        fprintf(stderr, "%s after %lu wrapped executions\n", label, runs);
+    else
+        fprintf(stderr, "%s only by --end\n", label);
+}
+
+void print_arm(const char const *label, const arm_t *arm) {
+    if (arm->armed == 0) {
+        fprintf(stderr, "%s no\n", label);
+        return;
+    }
+    fprintf(stderr, "%s wrap %lu executions after one", label, arm->runs);
+    if (arm->onfailure == 1)
+        fprintf(stderr, " fails");
+    if ((arm->onfailure == 1) && (arm->slowerthan > 0))
+        fprintf(stderr, " or");
+    if (arm->slowerthan > 0)
+        fprintf(stderr, " takes over %lu ms", arm->slowerthan / 1000);
+    fprintf(stderr, ", then ignore anomalies for %lu seconds\n", 
+            arm->cooldown);
+}
+
+void print_sample(const char const *label, const sample_t *sample) {
+    switch (sample->policy) {
+        case SAMPLE_EVERY:
+            fprintf(stderr, "%s every %lu executions\n", label, sample->every);
+            break;
+        case SAMPLE_PROBABILITY:
+            fprintf(stderr, "%s executions with probability %g\n", label,
+                    sample->probability);
+            break;
+        case SAMPLE_RATE:
+            fprintf(stderr, "%s at most %lu executions per second\n", label,
+                    sample->rate);
+            break;
+        default:
+            fprintf(stderr, "%s all executions\n", label);
     }
 }
 
 void print_stats(options_t *options, shared_t *shared) {
+    counters_t counters;
+    evictstats_t evictstats;
+    histogram_t histogram;
+    usage_t wrappedusage;
+    usage_t unwrappedusage;
+    config_t config;
+    unsigned long secondsleft=0;
+    unsigned long runsleft=0;
+    arm_t arm;
+
+    get_config(shared, &config);
+    inflight_reclaim(shared); /* don't count killed runs as in-flight */
+    get_counters(shared, &counters);
+    get_evictstats(shared, &evictstats);
     fprintf(stderr, "Statistics:\n");
     fprintf(stderr, "\tCommand: %s\n", options->command);
     fprintf(stderr, "\tCommand Hash: %s%s\n", options->cmdbasename,
                                               options->unique);
-    if (get_tracing(shared) == 1) 
+    if (config.tracing == 1) 
         fprintf(stderr, "\tWrapping currently: ON\n");
     else
         fprintf(stderr, "\tWrapping currently: OFF\n");
+    print_sample("\tSampling:", &(config.sample));
+    if ((config.tracing == 1) && (config.windowall == 1))
+        fprintf(stderr, "\tSampling bypassed: wrapping all until window "
+                        "ends\n");
+    if ((config.tracing == 1) && (config.windowid != 0)) {
+        get_windowleft(shared, &config, &secondsleft, &runsleft);
+        print_window("\tWindow: ending", secondsleft, runsleft);
+    }
+    get_arm(shared, &arm);
+    print_arm("\tArmed:", &arm);
+    fprintf(stderr, "\tAnomaly Triggers: %lu\n", counters.triggers);
     fprintf(stderr, "\tUnwrapped Executions: %lu\n", 
-                       shared->shmseg->unwrappedexecutions);
+                       counters.unwrappedexecutions);
+    fprintf(stderr, "\tSampled Out (ran unwrapped): %lu\n", 
+                       counters.sampledout);
+    if (config.maxconcurrent > 0)
+        fprintf(stderr, "\tMax Concurrent Wrapped: %lu\n", 
+                config.maxconcurrent);
+    else
+        fprintf(stderr, "\tMax Concurrent Wrapped: (no limit)\n");
+    fprintf(stderr, "\tDemoted (ran unwrapped): %lu\n", 
+                       counters.demoted);
+    fprintf(stderr, "\tIn-flight Wrapped: %lu (peak %lu)\n", 
+                       counters.inflight, counters.inflightpeak);
     fprintf(stderr, "\tWrapper Command: %s\n", shared->shmseg->wrapper);
+    if ((config.recordbytes > 0) && (config.recordslower > 0))
+        fprintf(stderr, "\tFlight Recorder: %lu bytes, kept on failure or "
+                        "over %lu ms\n", config.recordbytes, 
+                        config.recordslower / 1000);
+    else if (config.recordbytes > 0)
+        fprintf(stderr, "\tFlight Recorder: %lu bytes, kept on failure\n",
+                config.recordbytes);
+    else
+        fprintf(stderr, "\tFlight Recorder: off\n");
+    fprintf(stderr, "\tRecordings Kept: %lu\n", counters.recorded);
+    if (config.compress == 1)
+        fprintf(stderr, "\tWrapper Output: gzip compressed\n");
+    else
+        fprintf(stderr, "\tWrapper Output: uncompressed\n");
     fprintf(stderr, "\tWrapped Executions: %lu\n", 
-                       shared->shmseg->wrappedexecutions);
+                       counters.wrappedexecutions);
     fprintf(stderr, "\tOutdir: %s\n", shared->shmseg->outdir);
     fprintf(stderr, "\tKeep: %lu\n", shared->shmseg->keep - 1);
-    fprintf(stderr, "\tBegins: %lu\n", shared->shmseg->begins);
-    fprintf(stderr, "\tEnds: %lu\n", shared->shmseg->ends);
+    fprintf(stderr, "\tLogged: %lu\n", shared->shmseg->count);
+    if (config.maxbytes > 0)
+        fprintf(stderr, "\tMax Bytes: %lu\n", config.maxbytes);
+    else
+        fprintf(stderr, "\tMax Bytes: (no limit)\n");
+    fprintf(stderr, "\tRetained Bytes: %lu\n", counters.totalbytes);
+    fprintf(stderr, "\tBegins: %lu\n", counters.begins);
+    fprintf(stderr, "\tEnds: %lu\n", counters.ends);
+    fprintf(stderr, "\tLock Recoveries: %lu\n", counters.lockrecoveries);
+    if (evictstats.evictworker > 0)
+        fprintf(stderr, "\tEviction Worker: PID %d\n", 
+                evictstats.evictworker);
+    else
+        fprintf(stderr, "\tEviction Worker: (none)\n");
+    fprintf(stderr, "\tEviction Queue Depth: %lu\n", evictstats.evictcount);
+    fprintf(stderr, "\tEviction Backlog: %lu\n", 
+                       evictstats.evictcount + evictstats.evicting);
+    fprintf(stderr, "\tEvicted: %lu\n", evictstats.evicted);
+    fprintf(stderr, "\tEviction Failures: %lu\n", evictstats.evictfailures);
+    fprintf(stderr, "\tQuota Overruns: %lu\n", evictstats.quotaoverruns);
+    if (config.recycle == 1)
+        fprintf(stderr, "\tRecycling: on, keeping %s\n",
+                (config.recyclekeep[0] == '\0') ? "directories only" :
+                config.recyclekeep);
+    else
+        fprintf(stderr, "\tRecycling: off\n");
+    fprintf(stderr, "\tSpare Directories: %lu\n", evictstats.sparecount);
+    fprintf(stderr, "\tRecycled: %lu\n", evictstats.recycled);
+    if (shared->shmseg->eventwatcher > 0)
+        fprintf(stderr, "\tEvent Watcher: PID %d\n", 
+                shared->shmseg->eventwatcher);
+    else
+        fprintf(stderr, "\tEvent Watcher: (none)\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "Latency (microseconds):\n");
+    get_latency(shared, 0, &histogram);
+    print_latency("Unwrapped", &histogram);
+    get_latency(shared, 1, &histogram);
+    print_latency("Wrapped", &histogram);
+    fprintf(stderr, "\n");
+    fprintf(stderr, "Resource Usage:\n");
+    get_usage(shared, 0, &unwrappedusage);
+    print_usage("Unwrapped", &unwrappedusage);
+    get_usage(shared, 1, &wrappedusage);
+    print_usage("Wrapped", &wrappedusage);
+    print_overhead(&wrappedusage, &unwrappedusage);
     fprintf(stderr, "\n");
     fprintf(stderr, "Logring:\n");
     print_logring(shared);
 }
 
+/* interrupts generation_wait() so --watch can clean up */
+static void __watch_stop(int signum) {
+    watchstop = 1;
+}
+
+int watch(options_t *options, shared_t *shared) {
+    counters_t counters;
+    counters_t previous;
+    config_t config;
+    logentry_t *entries=NULL;
+    const logentry_t *entry=NULL;
+    struct timespec last;
+    struct timespec pause = { 0, WATCHNSEC };
+    struct sigaction action;
+    struct sigaction oldint;
+    struct sigaction oldterm;
+    unsigned long elapsed=0;
+    unsigned long count=0;
+    unsigned long counter=0;
+    unsigned int generation=0;
+
+    memset(&action, 0, sizeof(struct sigaction));
+    action.sa_handler = __watch_stop; /* no SA_RESTART */
+    sigaction(SIGINT, &action, &oldint);
+    sigaction(SIGTERM, &action, &oldterm);
+    get_counters(shared, &previous);
+    clock_gettime(CLOCK_MONOTONIC, &last);
+    while ((watchstop == 0) && (shared_alive(shared) == 1)) {
+        generation = get_generation(shared);
+        get_config(shared, &config);
+        get_counters(shared, &counters);
+        elapsed = utility_usecsince(&last);
+        clock_gettime(CLOCK_MONOTONIC, &last);
+        if (elapsed == 0)
+            elapsed = 1;
+        fprintf(stderr, "\033[H\033[2J%s: %s\n", shared->name, 
+                options->command);
+        fprintf(stderr, "Wrapping currently: %s, ", 
+                (config.tracing == 1) ? "ON" : "OFF");
+        print_sample("wrapping", &(config.sample));
+        fprintf(stderr, "Executions/sec: wrapped %.1f unwrapped %.1f\n",
+                (counters.wrappedexecutions - previous.wrappedexecutions) *
+                1000000.0 / elapsed,
+                (counters.unwrappedexecutions - 
+                 previous.unwrappedexecutions) * 1000000.0 / elapsed);
+        fprintf(stderr, "Executions: wrapped %lu unwrapped %lu sampled out "
+                "%lu demoted %lu in-flight %lu\n", 
+                counters.wrappedexecutions, counters.unwrappedexecutions, 
+                counters.sampledout, counters.demoted, counters.inflight);
+        fprintf(stderr, "Begins: %lu Ends: %lu Retained Bytes: %lu\n", 
+                counters.begins, counters.ends, counters.totalbytes);
+        fprintf(stderr, "Newest logged:\n");
+        /* lock free copy, a concurrent roll can't tear it */
+        count = get_logring(shared, &entries);
+        for (counter = 0; (counter < count) && (counter < WATCHNEWEST);
+             counter++) {
+            entry = &(entries[count - counter - 1]);
+            fprintf(stderr, "  %s (%lu bytes)\n", entry->path, entry->bytes);
+        }
+        if (count == 0)
+            fprintf(stderr, "  (empty)\n");
+        free(entries);
+        memcpy(&previous, &counters, sizeof(counters_t));
+        /* under load, show many changes at once rather than every one */
+        nanosleep(&pause, NULL);
+        while ((watchstop == 0) && (shared_alive(shared) == 1) &&
+               (generation_wait(shared, generation, WATCHIDLE) == 0))
+            continue; /* nothing changed, only check for --fini */
+    }
+    sigaction(SIGINT, &oldint, NULL);
+    sigaction(SIGTERM, &oldterm, NULL);
+    fprintf(stderr, "\n");
+    return E_SUCCESS;
+}
+
+int print_list(void) {
+    unsigned long index=0;
+    unsigned long rings=0;
+    shared_t *shared=NULL;
+    config_t config;
+    counters_t counters;
+
+    if (registry_attach() == NULL) {
+        fprintf(stderr, "Failed to open registry "REGISTRY_NAME"\n");
+        return E_NOSHARED;
+    }
+    fprintf(stderr, "Registry:\n");
+    while ((shared = next_shared(&index)) != NULL) {
+        get_config(shared, &config);
+        get_counters(shared, &counters);
+        fprintf(stderr, "\t%s: wrapping %s, wrapped %lu, unwrapped %lu, "
+                        "in-flight %lu, logged %lu of %lu, outdir %s\n",
+                shared->name, (config.tracing == 1) ? "ON" : "OFF",
+                counters.wrappedexecutions, counters.unwrappedexecutions,
+                counters.inflight, shared->shmseg->count,
+                config.keep - 1, 
+                (config.outdir[0] != '\0') ? config.outdir : "(none)");
+        free_shared(shared);
+        free(shared);
+        rings++;
+    }
+    if (rings == 0)
+        fprintf(stderr, "\t(empty)\n");
+    return E_SUCCESS;
+}
+
 int get_ko_result(options_t *options) {
     if ( ((options->outdir == NULL) && (options->keep > 2)) ||
          ((options->outdir != NULL) && (options->keep < 3)) ) {
@@ -96,7 +418,8 @@ int get_ko_result(options_t *options) {
 
 int get_shared_result(options_t *options, shared_t **shared) {
     *shared = get_shared(options->cmdbasename,
-                         options->unique);
+                         options->unique,
+                         options->registry);
     if (*shared != NULL) {
         return E_SUCCESS;
     } else {
@@ -107,13 +430,75 @@ int get_shared_result(options_t *options, shared_t **shared) {
     }
 }
 
+void get_sample(options_t *options, sample_t *sample) {
+    memset(sample, 0, sizeof(sample_t));
+    sample->policy = SAMPLE_ALL;
+    if (options->every > 0) {
+        sample->policy = SAMPLE_EVERY;
+        sample->every = options->every;
+    } else if (options->probability > 0.0) {
+        sample->policy = SAMPLE_PROBABILITY;
+        sample->probability = options->probability;
+    } else if (options->rate > 0) {
+        sample->policy = SAMPLE_RATE;
+        sample->rate = options->rate;
+    }
+}
+
+int init_arena(options_t *options, shared_t *shared) {
+    unsigned long segsize=0;
+    unsigned long segments=0;
+    char *arena=NULL;
+    int result=0;
+
+    segsize = arena_segsize(options->arena);
+    segments = (options->keep - 1) + ARENA_SPARE;
+    arena = arena_path(options->outdir, shared->name);
+    result = arena_create(arena, segsize, segments);
+    if (result == 0) {
+        set_arena(shared, segsize, segments);
+        fprintf(stderr, "Preallocated %lu segments of %lu bytes in %s\n",
+                segments, segsize, arena);
+    }
+    free(arena);
+    return result;
+}
+
+void init_recycle(options_t *options, shared_t *shared) {
+    char *keep=NULL;
+
+    /* the one file the next run's wrapper writes again, none with -ff
+       whose files are named by PIDs the next run won't have */
+    if ((options->wrapperff == 0) && (options->compress == 1))
+        keep = utility_strcat(options->cmdbasename, COMPRESS_SUFFIX);
+    else if (options->wrapperff == 0)
+        keep = utility_strcpy(options->cmdbasename);
+    set_recycle(shared, 1, keep);
+    free(keep);
+}
+
 int init(options_t *options, shared_t **shared) {
     int result = E_INIT; /* failure by default */
+    char *spare=NULL;
+    sample_t sample;
+    arm_t arm;
 
     switch (options->mode) {
         case MODE_STATS:
-            if ( (result = get_shared_result(options,shared)) == E_SUCCESS )
+            if ( (result = get_shared_result(options,shared)) != E_SUCCESS )
+                break;
+            if (options->format == EXPORT_TEXT)
                 print_stats(options, *shared);
+            else if (export_stats(*shared, options->command, options->format,
+                                  options->output) != 0)
+                result = E_EXPORT;
+            break;
+        case MODE_LIST:
+            result = print_list();
+            break;
+        case MODE_WATCH:
+            if ( (result = get_shared_result(options,shared)) == E_SUCCESS )
+                result = watch(options, *shared);
             break;
         case MODE_INIT:
             result = get_ko_result(options);
@@ -131,11 +516,28 @@ int init(options_t *options, shared_t **shared) {
                                      options->outdir,
                                      options->wrapper,
                                      options->cmdbasename,
-                                     options->unique);
+                                     options->unique,
+                                     options->registry);
                 if (*shared != NULL) { /* successful */
+                    if (options->maxconcurrent > 0)
+                        set_maxconcurrent(*shared, options->maxconcurrent);
+                    if (options->maxbytes > 0)
+                        set_maxbytes(*shared, options->maxbytes);
+                    set_compress(*shared, options->compress);
+                    set_record(*shared, options->record,
+                               options->recordslower * 1000);
+                    if (options->recycle == 1)
+                        init_recycle(options, *shared);
+                    if ((options->arena > 0) && (init_arena(options, 
+                                                            *shared) != 0))
+                        fprintf(stderr, "WARNING: Falling back to a "
+                                        "directory per run\n");
                     unlock_shared(*shared);
                     fprintf(stderr,"Successfully initialized shared data\n");
                     result = E_SUCCESS;
+                    if ( (options->keep > 2) &&
+                         (strstr(options->wrapper, MAGIC) != NULL) )
+                        result = start_evictworker(*shared);
                 } else {
                     options_showusage("Failed to initialize shared data, "
                                       "maybe it was already initialized?\n");
@@ -145,24 +547,64 @@ int init(options_t *options, shared_t **shared) {
             break;
         case MODE_FINI:
             if ( (result = get_shared_result(options,shared)) == E_SUCCESS ) {
+                evictworker_stop(*shared); /* finishes queue on it's own */
+                /* it removes spares too, unless it's gone already */
+                while ((spare = spare_pop(*shared)) != NULL)
+                    deldir((*shared)->shmseg->outdir, spare); /* frees */
                 lock_shared(*shared); /* be kind to others */
-                destroy_shared(*shared);
+                if (destroy_shared(*shared) != 0) {
+                    fprintf(stderr,"ERROR: Destroy shared data: %s\n",
+                            strerror(errno));
+                    result = E_NOSHARED;
+                } else
+                    fprintf(stderr,"Successfully destroyed shared data "
+                                   "(preserving any logged output)\n");
                 *shared = NULL;
-                fprintf(stderr,"Successfully destroyed shared data "
-                               "(preserving any logged output)\n");
             }
             break;
         case MODE_BEGIN:
             get_ko_result(options); /* print warning if needed */
             if ((result = get_shared_result(options,shared)) == E_SUCCESS) {
+                get_sample(options, &sample);
                 lock_shared(*shared);
+                set_sampling(*shared, &sample); /* changeable while on */
+                if (options->maxconcurrent >= 0)
+                    set_maxconcurrent(*shared, options->maxconcurrent);
+                if (options->maxbytes >= 0)
+                    set_maxbytes(*shared, options->maxbytes);
+                /* a new --begin always replaces any earlier bound */
+                set_window(*shared, options->forseconds, options->runs, 0);
                 if (get_tracing(*shared) == 0) {
                     set_tracing(*shared);
                     fprintf(stderr, "Switched tracing on\n");
                 }
                 unlock_shared(*shared);
+                print_sample("Wrapping", &sample);
+                print_window("Ending", options->forseconds, options->runs);
             }
             break;
+        case MODE_ARM:
+        case MODE_DISARM:
+            if ((result = get_shared_result(options,shared)) == E_SUCCESS) {
+                memset(&arm, 0, sizeof(arm_t));
+                if (options->mode == MODE_ARM) {
+                    arm.armed = 1;
+                    arm.onfailure = options->onfailure;
+                    arm.slowerthan = options->slowerthan * 1000;
+                    arm.runs = (options->runs > 0) ? options->runs 
+                                                   : DEFAULT_ARMRUNS;
+                    arm.cooldown = options->cooldown;
+                }
+                lock_shared(*shared);
+                set_arm(*shared, &arm);
+                unlock_shared(*shared);
+                print_arm("Armed:", &arm);
+            }
+            break;
+        case MODE_EXTRACT:
+            if ((result = get_shared_result(options,shared)) == E_SUCCESS)
+                result = extract(options, *shared);
+            break;
         case MODE_END:
             get_ko_result(options); /* print warning if needed */
             if ((result = get_shared_result(options,shared)) == E_SUCCESS) {
@@ -182,7 +624,8 @@ int init(options_t *options, shared_t **shared) {
             } else
                 /* Checks for NULL return later */
                 *shared = get_shared(options->cmdbasename,
-                                     options->unique);
+                                     options->unique,
+                                     options->registry);
                 result = E_SUCCESS; /* always succeeds */
             break;
         default:
@@ -191,109 +634,602 @@ int init(options_t *options, shared_t **shared) {
     return result;
 }
 
-char *outputdir(shared_t *shared) {
+char *outputname(const char const *basedir) {
     pid_t pid = getpid();
     size_t length=0;
     char *template=NULL;
     char *outdir=NULL;
     struct tm brokentime = { 0 };
-    int result=0;
     time_t t;
 
-    if (shared->shmseg->outdir != NULL) {
+    if ((basedir != NULL) && (*basedir != '\0')) {
         template = malloc(1024);
-        snprintf(template, 1024, "%s%s_PID-%u", shared->shmseg->outdir, 
-                 TEMPLATE, pid);
+        snprintf(template, 1024, "%s%s_PID-%u", basedir, TEMPLATE, pid);
         t = time(NULL);
         localtime_r(&t, &brokentime);
         length = strftime(NULL, -1, template, &brokentime);
         outdir = malloc(length + 1);
         strftime(outdir, (length + 1), template, &brokentime);
         free(template);
-        result = mkdir(outdir, S_IRWXU | S_IRWXG);
-        if (result != 0) {
-            fprintf(stderr,
-                    "ERROR: Create directory %s: %s\n",
-                    outdir, strerror(errno));
-            free(outdir);
-            return NULL;
-        }
         return outdir;
     } else
         return NULL;
 }
 
-int deldir(char *delandfree) {
-    char *cmd=NULL;
+char *outputdir(shared_t *shared, const char const *basedir) {
+    char *outdir=NULL;
+    char *spare=NULL;
+
+    outdir = outputname(basedir);
+    if ((outdir != NULL) && (shared != NULL) &&
+        ((spare = spare_pop(shared)) != NULL)) {
+        /* emptied by the eviction worker, one rename instead of mkdir */
+        if (rename(spare, outdir) == 0) {
+            count_recycled(shared);
+            free(spare);
+            return outdir;
+        }
+        fprintf(stderr, "ERROR: Rename %s to %s: %s\n", spare, outdir,
+                strerror(errno));
+        deldir(basedir, spare); /* frees, then fall back to mkdir */
+    }
+    if ((outdir != NULL) && (mkdir(outdir, S_IRWXU | S_IRWXG) != 0)) {
+        fprintf(stderr,
+                "ERROR: Create directory %s: %s\n",
+                outdir, strerror(errno));
+        free(outdir);
+        return NULL;
+    }
+    return outdir;
+}
+
+int spawnwait(char * const *argv, struct rusage *usage, 
+              recorder_t *recorder) {
+    pid_t pid=0;
+    int status=0;
     int result=0;
+    int outpipe[2] = { -1, -1 };
+    int errpipe[2] = { -1, -1 };
+    int pidfd=-1;
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_t *useactions=NULL;
+    posix_spawnattr_t attr;
+    sigset_t defaults;
+    struct sigaction ignore;
+    struct sigaction oldint;
+    struct sigaction oldquit;
 
-    if (delandfree != NULL) {
-        cmd = utility_strcat3(RMCOMMAND, " ", delandfree);
-        result = WEXITSTATUS(system(cmd));
-        if (result != 0) {
-            fprintf(stderr, "ERROR: %s removal failed.\n", delandfree);
+    /* Same as system(), ignore interrupts while child runs */
+    memset(usage, 0, sizeof(struct rusage));
+    memset(&ignore, 0, sizeof(struct sigaction));
+    ignore.sa_handler = SIG_IGN;
+    sigaction(SIGINT, &ignore, &oldint);
+    sigaction(SIGQUIT, &ignore, &oldquit);
+    /* but child gets them back, unless they were already ignored */
+    sigemptyset(&defaults);
+    if (oldint.sa_handler != SIG_IGN)
+        sigaddset(&defaults, SIGINT);
+    if (oldquit.sa_handler != SIG_IGN)
+        sigaddset(&defaults, SIGQUIT);
+    posix_spawnattr_init(&attr);
+    posix_spawnattr_setsigdefault(&attr, &defaults);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGDEF);
+    /* recording child's stdout and stderr, else it shares ours */
+    if ((recorder != NULL) && (pipe2(outpipe, O_CLOEXEC) == 0) &&
+        (pipe2(errpipe, O_CLOEXEC) == 0)) {
+        posix_spawn_file_actions_init(&actions);
+        posix_spawn_file_actions_adddup2(&actions, outpipe[1], STDOUT_FILENO);
+        posix_spawn_file_actions_adddup2(&actions, errpipe[1], STDERR_FILENO);
+        useactions = &actions;
+    } else if (recorder != NULL) { /* run unrecorded */
+        fprintf(stderr, "ERROR: Create recorder pipe: %s\n", 
+                strerror(errno));
+        if (outpipe[0] >= 0) {
+            close(outpipe[0]);
+            close(outpipe[1]);
         }
-        free(delandfree);
     }
+    result = posix_spawnp(&pid, argv[0], useactions, &attr, argv, environ);
+    posix_spawnattr_destroy(&attr);
+    if (useactions != NULL) { /* only the child writes into them now */
+        posix_spawn_file_actions_destroy(useactions);
+        close(outpipe[1]);
+        close(errpipe[1]);
+        if (result == 0) {
+#ifdef SYS_pidfd_open
+            /* readable once it exits, even with the pipes still held */
+            pidfd = syscall(SYS_pidfd_open, pid, 0);
+#endif
+            recorder_relay(recorder, outpipe[0], errpipe[0], pidfd);
+            if (pidfd >= 0)
+                close(pidfd);
+        } else {
+            close(outpipe[0]);
+            close(errpipe[0]);
+        }
+    }
+    if (result != 0) {
+        fprintf(stderr, "ERROR: Execute %s: %s\n", argv[0], strerror(result));
+        status = W_EXITCODE(SPAWNFAILED, 0);
+    } else 
+        while ((wait4(pid, &status, 0, usage) < 0) && (errno == EINTR))
+            continue;
+    sigaction(SIGINT, &oldint, NULL);
+    sigaction(SIGQUIT, &oldquit, NULL);
+    return status;
+}
+
+char *start_drain(const char const *outfile, run_t *run) {
+    char *fifo=NULL;
+    char *gzfile=NULL;
+    int fd=-1;
+    int result=0;
+
+    fifo = utility_strcat(outfile, FIFOSUFFIX);
+    if (mkfifo(fifo, S_IRUSR | S_IWUSR) != 0) {
+        fprintf(stderr, "ERROR: Create fifo %s: %s\n", fifo, strerror(errno));
+        free(fifo);
+        return NULL;
+    }
+    /* Holding a write end means the drain can't see EOF before the
+       wrapper opens the fifo, nor block forever if it never does. Only
+       the wrapper opens it by name, so the command never inherits it */
+    run->drainfd = open(fifo, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+    if (run->drainfd >= 0)
+        run->drain = fork();
+    if ((run->drainfd < 0) || (run->drain < 0)) {
+        fprintf(stderr, "ERROR: Starting drain for %s: %s\n", fifo,
+                strerror(errno));
+        if (run->drainfd >= 0)
+            close(run->drainfd);
+        run->drainfd = -1;
+        run->drain = 0;
+        unlink(fifo);
+        free(fifo);
+        return NULL;
+    } else if (run->drain > 0) /* This is the parent */
+        return fifo;
+    /* This is the child, a ^C meant for the command must not cut
+       the compressed stream short */
+    signal(SIGINT, SIG_IGN);
+    signal(SIGQUIT, SIG_IGN);
+    fd = open(fifo, O_RDONLY | O_CLOEXEC); /* parent is a writer, no wait */
+    close(run->drainfd);
+    if (fd < 0) {
+        fprintf(stderr, "ERROR: Open fifo %s: %s\n", fifo, strerror(errno));
+        unlink(fifo);
+        _exit(E_COMPRESS);
+    }
+    gzfile = utility_strcat(outfile, COMPRESS_SUFFIX);
+    result = compress_fd(fd, gzfile);
+    close(fd);
+    unlink(fifo);
+    _exit((result == 0) ? E_SUCCESS : E_COMPRESS);
+}
+
+int extract(options_t *options, shared_t *shared) {
+    logentry_t *entries=NULL;
+    logentry_t *entry=NULL;
+    unsigned long count=0;
+    unsigned long counter=0;
+    const char *name=NULL;
+    char *endptr=NULL;
+    char *arena=NULL;
+    char *outfile=NULL;
+    config_t config;
+    int result=E_SUCCESS;
+
+    get_config(shared, &config);
+    count = get_logring(shared, &entries);
+    counter = strtoul(options->extract, &endptr, 10);
+    if ((*endptr == '\0') && (counter < count)) /* --stats index */
+        entry = &(entries[counter]);
+    for (counter = 0; (entry == NULL) && (counter < count); counter++) {
+        name = strrchr(entries[counter].path, '/');
+        name = (name != NULL) ? name + 1 : entries[counter].path;
+        if ((strcmp(entries[counter].path, options->extract) == 0) ||
+            (strcmp(name, options->extract) == 0))
+            entry = &(entries[counter]);
+    }
+    if (entry == NULL) {
+        fprintf(stderr, "ERROR: No run %s in logring\n", options->extract);
+        free(entries);
+        return E_ARENA;
+    }
+    if (entry->arenaseq == 0) {
+        fprintf(stderr, "Run is already a directory: %s\n", entry->path);
+        free(entries);
+        return E_SUCCESS;
+    }
+    if ((mkdir(entry->path, S_IRWXU | S_IRWXG) != 0) && (errno != EEXIST)) {
+        fprintf(stderr, "ERROR: Create directory %s: %s\n", entry->path,
+                strerror(errno));
+        free(entries);
+        return E_OUTDIR;
+    }
+    outfile = utility_fullpath(entry->path, options->cmdbasename);
+    arena = arena_path(config.outdir, shared->name);
+    if (arena_extract(arena, config.arenasegsize, config.arenasegments,
+                      entry->arenaseq, outfile) != 0)
+        result = E_ARENA;
+    else
+        fprintf(stderr, "Extracted run to %s\n", outfile);
+    free(arena);
+    free(outfile);
+    free(entries);
     return result;
 }
 
-int execute(options_t *options, shared_t *shared, char **outdir) {
-    int result;
+int claim_arena(shared_t *shared, const config_t *config, run_t *run) {
+    char *arena=NULL;
+    unsigned long sequence=0;
+    int tries=0;
+    int result=1;
+
+    if ((config->keep < 3) || (config->arenasegsize == 0) ||
+        (strstr(config->wrapper, MAGIC) == NULL))
+        return 1; /* output doesn't go to an arena */
+    arena = arena_path(config->outdir, shared->name);
+    /* Sequences run ahead of the logring, skipped by demoted and
+       unwrapped runs.  A segment still being written by a slow run, or
+       still holding a logged one, is left be for the next */
+    for (tries = 0; (result == 1) && (tries < config->arenasegments); 
+         tries++) {
+        sequence = arena_next(shared);
+        if (arena_logged(shared, sequence, config->arenasegments) == 1)
+            continue;
+        result = arena_claim(arena, config->arenasegsize, 
+                             config->arenasegments, sequence);
+        /* it's last run might have been logged since the check */
+        if ((result == 0) && 
+            (arena_logged(shared, sequence, config->arenasegments) == 1)) {
+            arena_release(arena, config->arenasegsize, 
+                          config->arenasegments, sequence);
+            result = 1;
+        }
+    }
+    free(arena);
+    if (result != 0) { /* far more in flight than spare segments */
+        count_demoted(shared);
+        return 0;
+    }
+    run->arenaseq = sequence;
+    return 1;
+}
+
+void release_arena(shared_t *shared, const config_t *config, run_t *run) {
+    char *arena=NULL;
+
+    if (run->arenaseq == 0)
+        return;
+    arena = arena_path(config->outdir, shared->name);
+    arena_release(arena, config->arenasegsize, config->arenasegments,
+                  run->arenaseq);
+    free(arena);
+    run->arenaseq = 0;
+}
+
+char *start_arenadrain(const char const *arena, const config_t *config,
+                       run_t *run) {
+    int fds[2] = { -1, -1 };
+    char path[32];
+    sigset_t stopsig;
+    sigset_t oldmask;
+    int result=0;
+
+    if (pipe2(fds, O_CLOEXEC) != 0) {
+        fprintf(stderr, "ERROR: Create pipe for %s: %s\n", arena, 
+                strerror(errno));
+        return NULL;
+    }
+    /* wrapper must inherit the write end to open it by /dev/fd name */
+    fcntl(fds[1], F_SETFD, 0);
+    /* drain may only see the stop signal once it's ready for it */
+    sigemptyset(&stopsig);
+    sigaddset(&stopsig, ARENA_STOPSIG);
+    sigprocmask(SIG_BLOCK, &stopsig, &oldmask);
+    run->drain = fork();
+    if (run->drain != 0) { /* This is the parent */
+        sigprocmask(SIG_SETMASK, &oldmask, NULL);
+        close(fds[0]);
+        if (run->drain < 0) {
+            fprintf(stderr, "ERROR: Starting drain for %s: %s\n", arena,
+                    strerror(errno));
+            close(fds[1]);
+            run->drain = 0;
+            return NULL;
+        }
+        run->drainfd = fds[1];
+        snprintf(path, sizeof(path), "/dev/fd/%d", fds[1]);
+        return utility_strcpy(path);
+    }
+    /* This is the child, a ^C meant for the command must not cut
+       the output short */
+    signal(SIGINT, SIG_IGN);
+    signal(SIGQUIT, SIG_IGN);
+    close(fds[1]);
+    result = arena_drain(fds[0], arena, config->arenasegsize, 
+                         config->arenasegments, run->arenaseq);
+    _exit((result == 0) ? E_SUCCESS : E_ARENA);
+}
+
+int finish_drain(run_t *run) {
+    int status=0;
+
+    if (run->drain <= 0)
+        return 0;
+    close(run->drainfd); /* EOF once the wrapper is done with it too */
+    run->drainfd = -1;
+    /* anything the command left running may hold the arena pipe, but
+       the wrapper has exited so all it's output is waiting already */
+    if (run->arenaseq != 0)
+        kill(run->drain, ARENA_STOPSIG);
+    while ((waitpid(run->drain, &status, 0) < 0) && (errno == EINTR))
+        continue;
+    run->drain = 0;
+    if (!WIFEXITED(status) || (WEXITSTATUS(status) != E_SUCCESS)) {
+        if (run->arenaseq != 0)
+            fprintf(stderr, "ERROR: Writing wrapper output to arena failed\n");
+        else
+            fprintf(stderr, "ERROR: Compressing wrapper output failed\n");
+        return 1;
+    }
+    return 0;
+}
+
+int execinplace(options_t *options, shared_t *shared) {
+    /* no process will be left to count it afterwards */
+    count_execution(shared, 0);
+    events_notify(shared);
+    if (options->noshell == 1)
+        execvp(options->cmdargv[0], options->cmdargv);
+    else
+        execl("/bin/sh", "sh", "-c", options->command, (char *) NULL);
+    fprintf(stderr, "ERROR: Execute %s: %s\n", options->command,
+            strerror(errno));
+    return SPAWNFAILED;
+}
+
+void usagevalues(const struct rusage *usage, unsigned long *values) {
+    values[USAGE_UTIME] = usage->ru_utime.tv_sec * 1000000UL +
+                          usage->ru_utime.tv_usec;
+    values[USAGE_STIME] = usage->ru_stime.tv_sec * 1000000UL +
+                          usage->ru_stime.tv_usec;
+    values[USAGE_MAXRSS] = usage->ru_maxrss; /* already KiB on Linux */
+    values[USAGE_NVCSW] = usage->ru_nvcsw;
+    values[USAGE_NIVCSW] = usage->ru_nivcsw;
+    values[USAGE_INBLOCK] = usage->ru_inblock;
+    values[USAGE_OUBLOCK] = usage->ru_oublock;
+}
+
+int exitstatus(int status, run_t *run) {
+    run->status = status;
+    if (WIFSIGNALED(status)) {
+        run->signal = WTERMSIG(status);
+        return SIGNALEXIT + run->signal; /* same as /bin/sh */
+    }
+    return WEXITSTATUS(status);
+}
+
+int execute(options_t *options, shared_t *shared, run_t *run) {
+    int status=0;
     char *cmd=NULL;
     char *outfile=NULL;
+    char **wrapargv=NULL;
+    char **word=NULL;
+    char **argv=NULL;
+    char *fifo=NULL;
+    char *shargv[] = { "/bin/sh", "-c", NULL, NULL };
+    char *recordfile=NULL;
+    char *arena=NULL;
+    recorder_t *recorder=NULL;
+    config_t config;
+    struct rusage usage;
+    struct timespec started;
+    struct timespec benchstart;
 
-    if (shared != NULL) {
-        lock_shared(shared);
-        if (get_tracing(shared) == 1) {
-            cmd = utility_strcat3(shared->shmseg->wrapper," ",options->command);
-            if ( (shared->shmseg->keep > 2) && /* assume outdir was set */
-                 (strstr(shared->shmseg->wrapper, MAGIC) != NULL)) {
-                *outdir = outputdir(shared); /* creates directory also */
-                if (*outdir == NULL) /* catch creation errors */
-                    return E_OUTDIR;
-                outfile = utility_fullpath(*outdir, options->cmdbasename);
-                /* do the @@@ substitution */
-                cmd = utility_strsnr(cmd, MAGIC, outfile);
+    clock_gettime(CLOCK_MONOTONIC, &started);
+    /* lock free copy, never waits on --begin/--end */
+    get_config(shared, &config);
+    if ((shared != NULL) && (config.tracing == 1) &&
+        (sample_execution(shared, &config) == 1) &&
+        ((run->slot = inflight_acquire(shared, &config)) >= 0) &&
+        (claim_arena(shared, &config, run) == 1) && /* or demotes */
+        (window_claim(shared, &config) == 1)) { /* may end tracing */
+        run->wrapped = 1;
+        if (run->arenaseq != 0) {
+            /* nothing created on disk, outdir is only named for 
+               --extract and the logring */
+            run->outdir = outputname(config.outdir);
+            arena = arena_path(config.outdir, shared->name);
+            outfile = start_arenadrain(arena, &config, run);
+            free(arena);
+            if (outfile == NULL) {
+                release_arena(shared, &config, run);
+                inflight_release(shared, run->slot);
+                return E_ARENA;
+            }
+        } else if ( (config.keep > 2) && /* assume outdir was set */
+             (strstr(config.wrapper, MAGIC) != NULL)) {
+            run->outdir = outputdir(shared, config.outdir); /* creates it */
+            if (run->outdir == NULL) { /* catch creation errors */
+                inflight_release(shared, run->slot);
+                return E_OUTDIR;
+            }
+            /* retain outdir for deldir()*/
+            outfile = utility_fullpath(run->outdir, options->cmdbasename);
+            if ((config.compress == 1) && 
+                ((fifo = start_drain(outfile, run)) != NULL)) {
                 free(outfile);
-                /* retain outdir for deldir()*/
-            } else /* No magic outdir substitution needed */
-                cmd = utility_strcat3(shared->shmseg->wrapper, " ", 
-                      options->command);
-        } else
+                outfile = fifo; /* wrapper writes into drain instead */
+            } /* else fall back to writing uncompressed */
+        } /* else No magic outdir substitution needed */
+        if (options->noshell == 1) {
+            wrapargv = utility_argvsplit(config.wrapper);
+            if (wrapargv == NULL) {
+                fprintf(stderr, "ERROR: Unbalanced quotes in wrapper %s\n",
+                        config.wrapper);
+                release_arena(shared, &config, run);
+                inflight_release(shared, run->slot);
+                free(outfile);
+                return E_WRAPPER;
+            }
+            /* do the @@@ substitution word by word */
+            for (word = wrapargv; (outfile != NULL) && (*word != NULL); word++)
+                *word = utility_strsnr(*word, MAGIC, outfile);
+            argv = utility_argvcat(wrapargv, options->cmdargv);
+            utility_argvcfree(wrapargv);
+        } else {
+            cmd = utility_strcat3(config.wrapper, " ", options->command);
+            if (outfile != NULL) /* do the @@@ substitution */
+                cmd = utility_strsnr(cmd, MAGIC, outfile);
+        }
+        free(outfile);
+    } else {
+        /* window ended after claiming these, runs unwrapped without them */
+        release_arena(shared, &config, run); /* ignores none */
+        inflight_release(shared, run->slot); /* ignores -1 */
+        run->slot = -1;
+        if (options->exec == 1)
+            return execinplace(options, shared); /* run->status stays -1 */
+        if (options->noshell == 0)
             cmd = utility_strcpy(options->command);
-        unlock_shared(shared);
-    } else
-        cmd = utility_strcpy(options->command);
+    }
+    /* flight recorder only costs memory until the run misbehaves */
+    if ((run->wrapped == 0) && (config.recordbytes > 0) && 
+        (config.keep > 2))
+        recorder = recorder_new(config.recordbytes); /* NULL on failure */
     /* execute the command as a child process outside any locks */
-    result = WEXITSTATUS(system(cmd));
-    free(cmd);
-    return result;
+    BENCH_START(benchstart);
+    if (options->noshell == 1) {
+        if (argv != NULL)
+            status = spawnwait(argv, &usage, recorder);
+        else /* already split by options_get() */
+            status = spawnwait(options->cmdargv, &usage, recorder);
+        utility_argvcfree(argv);
+    } else { /* same as system(), but reaped with wait4() for usage */
+        shargv[2] = cmd;
+        status = spawnwait(shargv, &usage, recorder);
+        free(cmd);
+    }
+    BENCH_STOP(benchstart, spawn);
+    usagevalues(&usage, run->usage);
+    finish_drain(run); /* ignores no drain */
+    run->duration = utility_usecsince(&started);
+    if ((recorder != NULL) && 
+        ((status != 0) || ((config.recordslower > 0) && 
+                           (run->duration > config.recordslower))) &&
+        ((run->outdir = outputdir(shared, config.outdir)) != NULL)) {
+        /* ringroll() puts it in the logring like a wrapped run's */
+        outfile = utility_fullpath(run->outdir, options->cmdbasename);
+        recordfile = utility_strcat(outfile, RECORD_SUFFIX);
+        if (recorder_save(recorder, recordfile) == 0)
+            count_recorded(shared);
+        free(recordfile);
+        free(outfile);
+    }
+    recorder_free(recorder); /* ignores NULL */
+    inflight_release(shared, run->slot); /* ignores -1 */
+    return exitstatus(status, run);
 }
 
-int ringroll(shared_t *shared, char **outdir) {
-    int result=0;
+int start_evictworker(shared_t *shared) {
     pid_t forkresult=-1;
+    int fd=-1;
+    long maxfd=0;
 
     forkresult = fork();
-    if (forkresult == 0) { /* This is the child*/
-        /* Acquire lock and Increment counters */
-        if (shared != NULL) {
-            lock_shared(shared);
-            if (get_tracing(shared) == 1)
-                shared->shmseg->wrappedexecutions += 1;
-            else
-                shared->shmseg->unwrappedexecutions += 1;
-            unlock_shared(shared);
-            /* Rotate output directories if needed - ignores outdir=NULL 
-               logring_roll does locking */
-            if ( deldir( logring_roll(shared,*outdir) ) != 0 )
-                result = E_RMOUTDIR; /* there was a problem */
-        }
-        return result;
-    } else /* This is the parent */
+    if (forkresult < 0) {
+        fprintf(stderr, "ERROR: Starting eviction worker: %s\n",
+                strerror(errno));
+        return E_EVICTWORKER;
+    } else if (forkresult > 0) { /* This is the parent */
+        while ((waitpid(forkresult, NULL, 0) < 0) && (errno == EINTR))
+            continue;
+        return E_SUCCESS;
+    }
+    /* This is the child.  Hold the ring's slot while our parent still
+       does, so --fini and a registry_add() can't hand it to another ring
+       under the worker */
+    if (hold_shared(shared) != 0)
+        _exit(E_SUCCESS);
+    /* fork again so worker is never our zombie */
+    setsid();
+    forkresult = fork();
+    if (forkresult < 0)
+        free_shared(shared); /* nobody left to release it */
+    if (forkresult != 0)
+        _exit(E_SUCCESS);
+    /* Don't hold open anything of whoever ran us, e.g. a client socket */
+    fd = open("/dev/null", O_RDWR);
+    dup2(fd, STDIN_FILENO);
+    dup2(fd, STDOUT_FILENO);
+    dup2(fd, STDERR_FILENO);
+    maxfd = sysconf(_SC_OPEN_MAX);
+    for (fd = STDERR_FILENO + 1; fd < maxfd; fd++)
+        close(fd);
+    if (evictworker_register(shared) == 1)
+        evictworker(shared);
+    free_shared(shared); /* releases hold_shared() */
+    _exit(E_SUCCESS);
+}
+
+int ringroll(shared_t *shared, run_t *run) {
+    int result=0;
+    char *popped=NULL;
+    char *arena=NULL;
+    long bytes=0;
+    config_t config;
+    evictstats_t evictstats;
+
+    if (shared == NULL)
+        return 0;
+    /* Counters are atomic, no lock or child needed */
+    count_execution(shared, run->wrapped);
+    record_latency(shared, run->wrapped, run->duration);
+    record_usage(shared, run->wrapped, run->usage);
+    if (run->wrapped == 0) /* wraps the next ones if this one misbehaved */
+        anomaly_check(shared, (run->status != 0), run->duration);
+    if (run->outdir == NULL) {
+        events_notify(shared); /* nothing to rotate */
         return 0;
+    }
+    /* Rotate output directories - logring_roll does locking and
+       queues any evicted directory for the eviction worker.  Sizing
+       happens first, so the lock isn't held while walking the tree */
+    if (run->arenaseq != 0) { /* only the segment header to read */
+        get_config(shared, &config);
+        arena = arena_path(config.outdir, shared->name);
+        bytes = arena_length(arena, config.arenasegsize, 
+                             config.arenasegments, run->arenaseq);
+        free(arena);
+        if (bytes < 0)
+            bytes = 0; /* drain failed, or already overwritten */
+    } else
+        bytes = utility_dirsize(AT_FDCWD, run->outdir);
+    popped = logring_roll(shared, run->outdir, bytes, run->arenaseq);
+    if (run->arenaseq != 0) /* logged, segment stays until rolled out */
+        release_arena(shared, &config, run);
+    if (popped != NULL) { /* queue full, remove it ourselves */
+        get_config(shared, &config);
+        if (deldir(config.outdir, popped) != 0)
+            result = E_RMOUTDIR; /* there was a problem */
+    }
+    events_notify(shared); /* run is in the logring now */
+    get_evictstats(shared, &evictstats);
+    if ((evictstats.evictcount > 0) && (evictworker_missing(shared) == 1))
+        start_evictworker(shared); /* first eviction, or worker died */
+    return result;
+}
+
+#ifdef BENCHMARK
+void print_bench(run_t *run) {
+    fprintf(stderr, "bench: wrapped=%d parse_ns=%lu attach_ns=%lu "
+                    "lock_ns=%lu spawn_ns=%lu ringroll_ns=%lu total_ns=%lu\n",
+            run->wrapped, bench.parse, bench.attach, lock_waited(),
+            bench.spawn, bench.ringroll, bench.total);
 }
+#endif
 
 void fini(shared_t *shared) {
     free_shared(shared);
@@ -301,24 +1237,49 @@ void fini(shared_t *shared) {
 }
 
 int main(int argc, const char * const * const argv) {
-    char *outdir=NULL;
+    run_t run = { .status = -1, .slot = -1, .drainfd = -1 }; /* rest 0 */
     options_t *options=NULL;
     shared_t *shared=NULL;
     exitcode_t exitcode=E_SUCCESS;
+    int result=0;
+    int reraise=0;
+    struct timespec benchstart;
+    struct timespec benchtotal;
 
+    BENCH_START(benchtotal);
+    BENCH_START(benchstart);
     options = options_get(argc, argv);
+    BENCH_STOP(benchstart, parse);
     if (options == NULL)
         exitcode = E_ARGP;
-    else
+    else {
+        BENCH_START(benchstart);
         exitcode = init(options,&shared);
+        BENCH_STOP(benchstart, attach);
+    }
     if ((exitcode == E_SUCCESS) && (options->mode == MODE_EXECUTE)) {
-        exitcode = execute(options, shared, &outdir); /* allocates outdir */
-        if (exitcode == E_SUCCESS) 
-            exitcode = ringroll(shared, &outdir);
-        free(outdir);
+        exitcode = execute(options, shared, &run); /* allocates run.outdir */
+        if (run.status != -1) { /* command ran, even if it failed */
+            BENCH_START(benchstart);
+            result = ringroll(shared, &run);
+            BENCH_STOP(benchstart, ringroll);
+            if (exitcode == E_SUCCESS)
+                exitcode = result;
+        }
+        free(run.outdir);
+        BENCH_STOP(benchtotal, total);
+#ifdef BENCHMARK
+        print_bench(&run);
+#endif
     }
     else if (exitcode == E_SUCCESS)
         fprintf(stderr,"(no command was executed)\n");
-    fini(shared);
+    if ((options != NULL) && (options->noshell == 1))
+        reraise = run.signal; /* die the same way command did */
+    fini(shared); /* frees options */
+    if (reraise != 0) {
+        signal(reraise, SIG_DFL);
+        raise(reraise);
+    }
     return exitcode;
 }
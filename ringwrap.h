@@ -21,6 +21,18 @@
 #ifndef _RINGWRAP_H
 #define _RINGWRAP_H
 
+/* users of this need: 
+    #include <sys/types.h>
+    #include <sys/resource.h>
+    #include <semaphore.h>
+    #include <pthread.h>
+    #include "histogram.h"
+    #include "registry.h"
+    #include "ring.h"
+    #include "recorder.h"
+    #include "options.h"
+*/
+
 /**************************************************
 ********************* TYPES
 **************************************************/
@@ -35,51 +47,195 @@ typedef enum exitcode_e {
     E_RMOUTDIR, /* Error removing output directory */
     E_NOKO, /* both -k and -o were not specified together */
     E_NOCMD, /* No command specified for execution */
+    E_WRAPPER, /* Wrapper command could not be split into words */
+    E_EVICTWORKER, /* Could not start eviction worker */
+    E_COMPRESS, /* Could not compress wrapper output */
+    E_EXPORT, /* Could not write --stats --output file */
+    E_ARENA, /* Could not write to or extract from log arena */
 } exitcode_t;
 
+typedef struct run_s {
+    char *outdir; /* output directory created for this run or NULL */
+    int wrapped; /* 1 if executed with wrapper command, otherwise 0 */
+    int signal; /* signal that killed executed command or 0 */
+    int status; /* wait status of executed command or -1 if it never ran */
+    unsigned long duration; /* microseconds execute() took */
+    int slot; /* in-flight slot held while wrapped or -1 */
+    pid_t drain; /* process compressing wrapper output or 0 */
+    int drainfd; /* write end of drain fifo held open by us or -1 */
+    unsigned long usage[USAGE_FIELDS]; /* resources the command used */
+    unsigned long arenaseq; /* arena sequence wrapper output went to or 0 */
+} run_t;
+
+#ifdef BENCHMARK
+typedef struct bench_s {
+    unsigned long parse; /* nanoseconds in options_get() */
+    unsigned long attach; /* in init(), for executions mostly get_shared() */
+    unsigned long spawn; /* running the command, wrapped or not */
+    unsigned long ringroll; /* in ringroll() */
+    unsigned long total; /* in main() */
+} bench_t;
+#endif
+
 /**************************************************
 ********************* MACROS
 **************************************************/
+#ifdef BENCHMARK
+#define BENCH_START(start) clock_gettime(CLOCK_MONOTONIC, &(start))
+#define BENCH_STOP(start, phase) (bench.phase += utility_nsecsince(&(start)))
+#else /* compiled out, but keep start "used" */
+#define BENCH_START(start) ((void)(start))
+#define BENCH_STOP(start, phase) ((void)(start))
+#endif
 #define TEMPLATE "%F_%T"
-#define RMCOMMAND "rm --force --preserve-root --recursive"
+#define SPAWNFAILED 127 /* exit code when command can't be executed */
+#define SIGNALEXIT 128 /* exit code base when command is killed */
+#define FIFOSUFFIX ".fifo" /* appended to fifo name replacing MAGIC */
+#define WATCHNEWEST 5 /* logring entries --watch shows */
+#define WATCHNSEC 100000000 /* --watch redraws at most every 100ms */
+#define WATCHIDLE 1 /* seconds --watch waits before checking for --fini */
 
 /**************************************************
 ********************* FUNCTION DEFINITIONS
 **************************************************/
 
+/* prints out summary of latency histogram to stderr */
+void print_latency(const char const *label, histogram_t *histogram);
+
+/* prints out totals, means and maxima of resource usage to stderr */
+void print_usage(const char const *label, const usage_t *usage);
+
+/* prints out how much more resources wrapped executions used on average
+   than unwrapped ones to stderr, if there were both */
+void print_overhead(const usage_t *wrapped, const usage_t *unwrapped);
+
+/* prints out description of tracing window bounds to stderr */
+void print_window(const char const *label, unsigned long seconds,
+                  unsigned long runs);
+
+/* prints out description of anomaly trigger to stderr */
+void print_arm(const char const *label, const arm_t *arm);
+
+/* prints out description of sampling policy to stderr */
+void print_sample(const char const *label, const sample_t *sample);
+
 /* prints out current statistics to stderr */
 void print_stats(options_t *options, shared_t *shared);
 
+/* redraws summary of shared on stderr whenever it changes, without
+   locking, until interrupted or shared is destroyed */
+int watch(options_t *options, shared_t *shared);
+
+/* prints out every ring in the registry to stderr, in one pass */
+int print_list(void);
+
 /* verify both -k and -o options were specified */
 int get_ko_result(options_t *options);
 
 /* retrieve shared data and report result */
 int get_shared_result(options_t *options, shared_t **shared);
 
+/* fills sample with sampling policy from options */
+void get_sample(options_t *options, sample_t *sample);
+
+/* creates arena for options->keep runs of options->arena bytes each
+   in options->outdir and sets shared to use it. Returns 0 on success.
+   Requires Locking. */
+int init_arena(options_t *options, shared_t *shared);
+
+/* sets shared to empty evicted directories for reuse, keeping the
+   file named after options' command. Requires Locking. */
+void init_recycle(options_t *options, shared_t *shared);
+
 /* initialize shared based on options */
 int init(options_t *options, shared_t **shared);
 
-/* returns new <options->outdir>/YYYY-MM-DD_HH:MM:SS_PID/<cmdbasename> 
-   creating date/time directory and returning full path or NULL on failure */
-char *outputdir(shared_t *shared);
-
-/* recursivly removes path pointed to by delandfree then frees delandfree.
-   returns non-zero on failiure */
-int deldir(char *delandfree);
+/* returns new <basedir>/YYYY-MM-DD_HH:MM:SS_PID-<PID> without creating
+   it, or NULL if there is no basedir */
+char *outputname(const char const *basedir);
+
+/* returns new <basedir>/YYYY-MM-DD_HH:MM:SS_PID-<PID> creating 
+   date/time directory, by renaming a spare one into place if shared
+   has any, and returning full path or NULL on failure */
+char *outputdir(shared_t *shared, const char const *basedir);
+
+/* materializes logring run options->extract, given as it's path, 
+   directory name or --stats index, from the arena as a file in it's
+   directory.  Returns exit code */
+int extract(options_t *options, shared_t *shared);
+
+/* spawns argv directly (searching PATH) without a shell, waits 
+   for it to exit and returns wait status the same as system().  Fills
+   usage with resources it and it's reaped descendants used.  If
+   recorder isn't NULL, it's stdout and stderr go through it. */
+int spawnwait(char * const *argv, struct rusage *usage, 
+              recorder_t *recorder);
+
+/* converts usage into values indexed by usagefield_t */
+void usagevalues(const struct rusage *usage, unsigned long *values);
+
+/* makes fifo outfile.fifo and forks a process compressing everything 
+   written to it into outfile.gz, noting it in run.  Returns the fifo's 
+   path for MAGIC substitution or NULL on failure. */
+char *start_drain(const char const *outfile, run_t *run);
+
+/* claims a free arena segment for run, skipping sequences whose segment
+   is still being written, setting run->arenaseq.  Returns 1 if claimed 
+   or config has no arena, 0 counting execution as demoted otherwise */
+int claim_arena(shared_t *shared, const config_t *config, run_t *run);
+
+/* gives up run's arena segment from claim_arena() if it won't be 
+   written after all */
+void release_arena(shared_t *shared, const config_t *config, run_t *run);
+
+/* starts process writing what the wrapper writes to the returned 
+   /dev/fd/<N> path into run->arenaseq's segment of arena, or returns
+   NULL on failure.  Like start_drain(), but nothing is created on disk */
+char *start_arenadrain(const char const *arena, const config_t *config,
+                       run_t *run);
+
+/* lets drain process in run finish and waits for it.  Returns non-zero
+   if compression failed. */
+int finish_drain(run_t *run);
+
+/* counts an unwrapped execution, then replaces this process with
+   options->command (through /bin/sh unless options->noshell).  Only
+   returns, with an exit code, if that fails. */
+int execinplace(options_t *options, shared_t *shared);
+
+/* returns exit code from wait status, noting any killing signal in run */
+int exitstatus(int status, run_t *run);
 
 /* depending on shared->shmseg->tracing either executes 
    options->command or options->trace options->command returns exit code.
-   outdir will be allocated and set to the string of the output directory 
-   used */
-int execute(options_t *options, shared_t *shared, char **outdir);
-
-/* Fork child process to rotate logs and remove old log directory if needed
-   Free's outdir. */
-int ringroll(shared_t *shared, char **outdir);
+   Uses spawnwait() on split words instead of /bin/sh -c if options->noshell.
+   Resources the command used are left in run->usage.  Unwrapped
+   executions go through a flight recorder if configured, saved into a
+   new run->outdir only if the command failed or was slow.
+   Only locks shared to end a tracing window it used up.  run->outdir
+   will be allocated and set to the string of the output directory
+   used, run->wrapped records the choice made.
+   If options->exec and not wrapping, never returns unless execinplace()
+   fails.
+   If compressing, MAGIC names a fifo drained by start_drain(). */
+int execute(options_t *options, shared_t *shared, run_t *run);
+
+/* starts detached process running evictworker() if none is registered */
+int start_evictworker(shared_t *shared);
+
+/* Count execution, then rotate logs if run->outdir was used, leaving
+   removal of old log directory to the eviction worker.  Never forks
+   except to start a missing eviction worker. */
+int ringroll(shared_t *shared, run_t *run);
 
 /* Clean up allocated memory */
 void fini(shared_t *shared);
 
+#ifdef BENCHMARK
+/* prints bench phase timings of this invocation as one line to stderr */
+void print_bench(run_t *run);
+#endif
+
 /* main program function */
 int main(int argc, const char * const * const argv);
 
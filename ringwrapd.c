@@ -0,0 +1,494 @@
+/*
+#
+# Copyright (C) 2010 by Chris Evich <cevich@redhat.com>
+#
+#   This library is free software; you can redistribute it and/or
+#   modify it under the terms of the GNU Lesser General Public
+#   License as published by the Free Software Foundation; either
+#   version 2.1 of the License, or (at your option) any later version.
+#
+#   This library is distributed in the hope that it will be useful,
+#   but WITHOUT ANY WARRANTY; without even the implied warranty of
+#   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+#   Lesser General Public License for more details.
+#
+#   You should have received a copy of the GNU Lesser General Public
+#   License along with this library; if not, write to the Free Software
+#   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+#
+*/
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <semaphore.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <signal.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include "version.h"
+#include "utility.h"
+#include "histogram.h"
+#include "registry.h"
+#include "ring.h"
+#include "evict.h"
+#include "ringwrapd.h"
+
+/**************************************************
+********************* PRIVATE MACROS
+**************************************************/
+#define ATOMIC_GET(ptr) __atomic_load_n((ptr), __ATOMIC_ACQUIRE)
+#define ATOMIC_SET(ptr, val) __atomic_store_n((ptr), (val), __ATOMIC_RELEASE)
+#define ONOFF(tracing) (((tracing) == 1) ? "on" : "off")
+
+/**************************************************
+********************* GLOBALS
+**************************************************/
+ringd_t rings[DAEMON_RINGS]; /* only main thread attaches / detaches */
+client_t clients[DAEMON_CLIENTS];
+pthread_mutex_t clientlock = PTHREAD_MUTEX_INITIALIZER; /* guards clients
+                                                   against watchers */
+volatile sig_atomic_t stopping=0; /* set by SIGINT / SIGTERM */
+
+/**************************************************
+********************* PRIVATE FUNCTIONS
+**************************************************/
+
+static void __stop(int signum) {
+    stopping = 1;
+}
+
+/**************************************************
+********************* FUNCTIONS
+**************************************************/
+
+void client_send(client_t *client, const char const *line) {
+    size_t length = strlen(line);
+
+    if (client->fd < 0)
+        return;
+    /* never let one slow subscriber hold up a ring's watcher */
+    if (send(client->fd, line, length, MSG_DONTWAIT | MSG_NOSIGNAL) != 
+        (ssize_t) length) {
+        client->subscribed = 0;
+        shutdown(client->fd, SHUT_RDWR); /* main loop closes it */
+    }
+}
+
+void broadcast(const char const *name, const char const *line) {
+    int counter=0;
+
+    pthread_mutex_lock(&clientlock);
+    for (; counter < DAEMON_CLIENTS; counter++)
+        if ((clients[counter].subscribed == 1) &&
+            ((clients[counter].filter[0] == '\0') ||
+             (strcmp(clients[counter].filter, name) == 0)))
+            client_send(&(clients[counter]), line);
+    pthread_mutex_unlock(&clientlock);
+}
+
+void ringd_events(ringd_t *ringd) {
+    shared_t *shared = ringd->shared;
+    counters_t counters;
+    evictstats_t evictstats;
+    logentry_t *entries=NULL;
+    unsigned long count=0;
+    char path[MAXDIRSTRLEN] = "-";
+    char line[DAEMON_LINELEN];
+
+    get_counters(shared, &counters);
+    get_evictstats(shared, &evictstats);
+    if ((counters.begins != ringd->counters.begins) ||
+        (counters.ends != ringd->counters.ends)) {
+        snprintf(line, DAEMON_LINELEN, "event tracing %s %s\n", shared->name,
+                 ONOFF(get_tracing(shared)));
+        broadcast(shared->name, line);
+    }
+    if ((counters.wrappedexecutions != ringd->counters.wrappedexecutions) ||
+        (counters.unwrappedexecutions != 
+         ringd->counters.unwrappedexecutions)) {
+        if (counters.wrappedexecutions != ringd->counters.wrappedexecutions) {
+            /* lock free copy, executions never wait on us */
+            count = get_logring(shared, &entries);
+            if ((count > 0) && (entries[count - 1].path[0] != '\0'))
+                memcpy(path, entries[count - 1].path, MAXDIRSTRLEN);
+            free(entries);
+        }
+        snprintf(line, DAEMON_LINELEN, 
+                 "event completed %s wrapped %lu unwrapped %lu newest %s\n",
+                 shared->name, 
+                 counters.wrappedexecutions - 
+                 ringd->counters.wrappedexecutions,
+                 counters.unwrappedexecutions - 
+                 ringd->counters.unwrappedexecutions, path);
+        broadcast(shared->name, line);
+    }
+    if (evictstats.evicted != ringd->evicted) {
+        snprintf(line, DAEMON_LINELEN, "event evicted %s %lu\n", 
+                 shared->name, evictstats.evicted - ringd->evicted);
+        broadcast(shared->name, line);
+    }
+    memcpy(&(ringd->counters), &counters, sizeof(counters_t));
+    ringd->evicted = evictstats.evicted;
+}
+
+void *ringd_watcher(void *arg) {
+    ringd_t *ringd = (ringd_t *) arg;
+
+    while (ATOMIC_GET(&(ringd->stop)) == 0) {
+        events_wait(ringd->shared, DAEMON_RESCAN);
+        ringd_events(ringd); /* cheap enough to also do on timeout */
+    }
+    return NULL;
+}
+
+void *ringd_evictor(void *arg) {
+    evictworker(((ringd_t *) arg)->shared);
+    return NULL;
+}
+
+ringd_t *ringd_attach(shared_t *shared) {
+    ringd_t *ringd=NULL;
+    evictstats_t evictstats;
+    config_t config;
+    int counter=0;
+
+    for (; (counter < DAEMON_RINGS) && (ringd == NULL); counter++)
+        if (rings[counter].shared == NULL)
+            ringd = &(rings[counter]);
+    if (ringd == NULL) {
+        fprintf(stderr, "ERROR: Watching too many rings for %s\n", 
+                shared->name);
+        free_shared(shared);
+        free(shared);
+        return NULL;
+    }
+    memset(ringd, 0, sizeof(ringd_t));
+    ringd->shared = shared;
+    get_counters(shared, &(ringd->counters)); /* only report from now on */
+    get_evictstats(shared, &evictstats);
+    ringd->evicted = evictstats.evicted;
+    events_register(shared, 1);
+    if (pthread_create(&(ringd->watcher), NULL, ringd_watcher, ringd) != 0) {
+        fprintf(stderr, "ERROR: Watching %s: %s\n", shared->name, 
+                strerror(errno));
+        events_register(shared, 0);
+        free_shared(shared);
+        free(shared);
+        ringd->shared = NULL;
+        return NULL;
+    }
+    get_config(shared, &config);
+    if (config.keep > 2) { /* has an outdir, take over it's eviction */
+        evictworker_stop(shared); /* any worker drains queue and exits */
+        if (evictworker_register(shared) == 1) {
+            if (pthread_create(&(ringd->evictor), NULL, ringd_evictor, 
+                               ringd) == 0)
+                ringd->hosting = 1;
+            else
+                evictworker_stop(shared); /* executions start one */
+        }
+    }
+    fprintf(stderr, "Watching %s%s\n", shared->name, 
+            (ringd->hosting == 1) ? ", hosting it's eviction" : "");
+    return ringd;
+}
+
+void ringd_detach(ringd_t *ringd) {
+    ATOMIC_SET(&(ringd->stop), 1);
+    events_register(ringd->shared, 0);
+    pthread_join(ringd->watcher, NULL);
+    if (ringd->hosting == 1) {
+        evictworker_stop(ringd->shared); /* executions start a new one */
+        pthread_join(ringd->evictor, NULL); /* once queue is drained */
+    }
+    fprintf(stderr, "Stopped watching %s\n", ringd->shared->name);
+    free_shared(ringd->shared);
+    free(ringd->shared);
+    memset(ringd, 0, sizeof(ringd_t));
+}
+
+ringd_t *ringd_find(const char const *name) {
+    shared_t *shared=NULL;
+    int counter=0;
+
+    for (; counter < DAEMON_RINGS; counter++)
+        if ((rings[counter].shared != NULL) &&
+            (strcmp(rings[counter].shared->name, name) == 0))
+            return &(rings[counter]);
+    if ((shared = get_shared_byname(name, 1)) == NULL)
+        shared = get_shared_byname(name, 0);
+    if (shared == NULL)
+        return NULL;
+    return ringd_attach(shared);
+}
+
+void ringd_rescan(void) {
+    shared_t *shared=NULL;
+    unsigned long index=0;
+    int counter=0;
+    int found=0;
+
+    for (; counter < DAEMON_RINGS; counter++)
+        if ((rings[counter].shared != NULL) &&
+            (shared_alive(rings[counter].shared) == 0))
+            ringd_detach(&(rings[counter]));
+    while ((shared = next_shared(&index)) != NULL) {
+        for (found = 0, counter = 0; 
+             (counter < DAEMON_RINGS) && (found == 0); counter++)
+            found = ((rings[counter].shared != NULL) &&
+                     (strcmp(rings[counter].shared->name, shared->name) == 0));
+        if (found == 0)
+            ringd_attach(shared); /* keeps shared */
+        else {
+            free_shared(shared);
+            free(shared);
+        }
+    }
+}
+
+void command(client_t *client, char *line) {
+    char reply[DAEMON_LINELEN];
+    char *verb=NULL;
+    char *name=NULL;
+    char *saveptr=NULL;
+    ringd_t *ringd=NULL;
+    shared_t *shared=NULL;
+    counters_t counters;
+    evictstats_t evictstats;
+    histogram_t wrapped;
+    histogram_t unwrapped;
+    config_t config;
+    int counter=0;
+
+    verb = strtok_r(line, " \t\r", &saveptr);
+    name = strtok_r(NULL, " \t\r", &saveptr);
+    if (verb == NULL)
+        return; /* blank line */
+    if (strcmp(verb, "list") == 0) {
+        for (; counter < DAEMON_RINGS; counter++) {
+            if ((shared = rings[counter].shared) == NULL)
+                continue;
+            get_config(shared, &config);
+            get_counters(shared, &counters);
+            snprintf(reply, DAEMON_LINELEN, "ring %s tracing %s wrapped %lu "
+                     "unwrapped %lu logged %lu keep %lu eviction %s\n",
+                     shared->name, ONOFF(config.tracing), 
+                     counters.wrappedexecutions,
+                     counters.unwrappedexecutions, shared->shmseg->count,
+                     config.keep - 1, 
+                     (rings[counter].hosting == 1) ? "hosted" : "separate");
+            client_send(client, reply);
+        }
+        client_send(client, "ok\n");
+    } else if (strcmp(verb, "subscribe") == 0) {
+        memset(client->filter, 0, REGISTRY_NAMELEN);
+        if (name != NULL) {
+            if (ringd_find(name) == NULL) {
+                client_send(client, "error no such ring\n");
+                return;
+            }
+            strncpy(client->filter, name, REGISTRY_NAMELEN - 1);
+        }
+        client->subscribed = 1;
+        client_send(client, "ok\n");
+    } else if (strcmp(verb, "unsubscribe") == 0) {
+        client->subscribed = 0;
+        client_send(client, "ok\n");
+    } else if ((strcmp(verb, "begin") != 0) && (strcmp(verb, "end") != 0) &&
+               (strcmp(verb, "stats") != 0))
+        client_send(client, "error unknown command\n");
+    else if (name == NULL)
+        client_send(client, "error ring name required\n");
+    else if ((ringd = ringd_find(name)) == NULL)
+        client_send(client, "error no such ring\n");
+    else if (strcmp(verb, "stats") == 0) {
+        shared = ringd->shared;
+        get_config(shared, &config);
+        get_counters(shared, &counters);
+        get_evictstats(shared, &evictstats);
+        get_latency(shared, 1, &wrapped);
+        get_latency(shared, 0, &unwrapped);
+        snprintf(reply, DAEMON_LINELEN, "ok %s tracing %s wrapped %lu "
+                 "unwrapped %lu sampledout %lu demoted %lu inflight %lu "
+                 "begins %lu ends %lu logged %lu keep %lu bytes %lu "
+                 "evicted %lu evictfailures %lu lockrecoveries %lu "
+                 "wrapped_p50_us %lu wrapped_p99_us %lu "
+                 "unwrapped_p50_us %lu unwrapped_p99_us %lu\n",
+                 shared->name, ONOFF(config.tracing),
+                 counters.wrappedexecutions, counters.unwrappedexecutions,
+                 counters.sampledout, counters.demoted, counters.inflight,
+                 counters.begins, counters.ends, shared->shmseg->count,
+                 config.keep - 1, counters.totalbytes, evictstats.evicted,
+                 evictstats.evictfailures, counters.lockrecoveries,
+                 histogram_percentile(&wrapped, 50.0),
+                 histogram_percentile(&wrapped, 99.0),
+                 histogram_percentile(&unwrapped, 50.0),
+                 histogram_percentile(&unwrapped, 99.0));
+        client_send(client, reply);
+    } else { /* begin or end, same as --begin/--end w/o options */
+        lock_shared(ringd->shared);
+        if ((strcmp(verb, "begin") == 0) && (get_tracing(ringd->shared) == 0))
+            set_tracing(ringd->shared);
+        else if ((strcmp(verb, "end") == 0) && 
+                 (get_tracing(ringd->shared) == 1))
+            unset_tracing(ringd->shared);
+        unlock_shared(ringd->shared);
+        client_send(client, "ok\n");
+    }
+}
+
+int client_read(client_t *client) {
+    ssize_t length=0;
+    char *newline=NULL;
+    size_t used=0;
+
+    length = read(client->fd, client->line + client->linelen,
+                  DAEMON_LINELEN - 1 - client->linelen);
+    if (length <= 0)
+        return ((length < 0) && (errno == EINTR)) ? 0 : 1;
+    client->linelen += length;
+    client->line[client->linelen] = '\0';
+    while ((newline = strchr(client->line + used, '\n')) != NULL) {
+        *newline = '\0';
+        pthread_mutex_lock(&clientlock); /* replies don't split events */
+        command(client, client->line + used);
+        pthread_mutex_unlock(&clientlock);
+        used = (newline - client->line) + 1;
+    }
+    client->linelen -= used;
+    memmove(client->line, client->line + used, client->linelen);
+    if (client->linelen >= DAEMON_LINELEN - 1) {
+        pthread_mutex_lock(&clientlock);
+        client_send(client, "error line too long\n");
+        pthread_mutex_unlock(&clientlock);
+        return 1;
+    }
+    return 0;
+}
+
+int listen_socket(const char const *path) {
+    struct sockaddr_un address;
+    int fd=-1;
+
+    memset(&address, 0, sizeof(struct sockaddr_un));
+    address.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(address.sun_path)) {
+        fprintf(stderr, "ERROR: Socket path %s too long\n", path);
+        return -1;
+    }
+    strncpy(address.sun_path, path, sizeof(address.sun_path) - 1);
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        fprintf(stderr, "ERROR: Socket: %s\n", strerror(errno));
+        return -1;
+    }
+    /* only replace a socket nobody is listening on anymore */
+    if (connect(fd, (struct sockaddr *) &address, 
+                sizeof(struct sockaddr_un)) == 0) {
+        fprintf(stderr, "ERROR: Another daemon is listening on %s\n", path);
+        close(fd);
+        return -1;
+    }
+    unlink(path);
+    if ((bind(fd, (struct sockaddr *) &address, 
+              sizeof(struct sockaddr_un)) != 0) ||
+        (chmod(path, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP) != 0) ||
+        (listen(fd, DAEMON_CLIENTS) != 0)) {
+        fprintf(stderr, "ERROR: Listen on %s: %s\n", path, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int main(int argc, char * const *argv) {
+    const char *path = DAEMON_SOCKET;
+    struct pollfd fds[DAEMON_CLIENTS + 1];
+    struct sigaction action;
+    int listenfd=-1;
+    int option=0;
+    int counter=0;
+    int fd=-1;
+
+    while ((option = getopt(argc, argv, "S:h")) != -1) {
+        switch (option) {
+            case 'S':
+                path = optarg;
+                break;
+            default:
+                fprintf(stderr, "Usage: %sd [-S socket] [ring name...]\n"
+                        "Watches every --registry ring, plus any own "
+                        "segment rings named, serving\ncommands and "
+                        "events on socket (default "DAEMON_SOCKET").\n",
+                        PROGNAM);
+                return (option == 'h') ? D_SUCCESS : D_ARGS;
+        }
+    }
+    memset(&action, 0, sizeof(struct sigaction));
+    action.sa_handler = __stop; /* no SA_RESTART, poll() must return */
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    signal(SIGPIPE, SIG_IGN);
+    if ((listenfd = listen_socket(path)) < 0)
+        return D_SOCKET;
+    for (counter = 0; counter < DAEMON_CLIENTS; counter++)
+        clients[counter].fd = -1;
+    for (; optind < argc; optind++)
+        if (ringd_find(argv[optind]) == NULL)
+            fprintf(stderr, "WARNING: No ring %s\n", argv[optind]);
+    ringd_rescan();
+    fprintf(stderr, "Listening on %s\n", path);
+    while (stopping == 0) {
+        fds[0].fd = listenfd;
+        fds[0].events = POLLIN;
+        for (counter = 0; counter < DAEMON_CLIENTS; counter++) {
+            fds[counter + 1].fd = clients[counter].fd; /* -1 is ignored */
+            fds[counter + 1].events = POLLIN;
+            fds[counter + 1].revents = 0;
+        }
+        if (poll(fds, DAEMON_CLIENTS + 1, DAEMON_RESCAN * 1000) <= 0) {
+            ringd_rescan(); /* idle or signaled */
+            continue;
+        }
+        for (counter = 0; counter < DAEMON_CLIENTS; counter++) {
+            if ((fds[counter + 1].revents == 0) ||
+                (client_read(&(clients[counter])) == 0))
+                continue;
+            pthread_mutex_lock(&clientlock);
+            close(clients[counter].fd);
+            memset(&(clients[counter]), 0, sizeof(client_t));
+            clients[counter].fd = -1;
+            pthread_mutex_unlock(&clientlock);
+        }
+        if ((fds[0].revents & POLLIN) != 0) {
+            fd = accept4(listenfd, NULL, NULL, SOCK_CLOEXEC);
+            for (counter = 0; (fd >= 0) && (counter < DAEMON_CLIENTS); 
+                 counter++)
+                if (clients[counter].fd < 0)
+                    break;
+            if ((fd >= 0) && (counter == DAEMON_CLIENTS)) {
+                send(fd, "error too many clients\n", 23, MSG_NOSIGNAL);
+                close(fd);
+            } else if (fd >= 0) {
+                pthread_mutex_lock(&clientlock);
+                clients[counter].fd = fd;
+                pthread_mutex_unlock(&clientlock);
+            }
+        }
+    }
+    for (counter = 0; counter < DAEMON_RINGS; counter++)
+        if (rings[counter].shared != NULL)
+            ringd_detach(&(rings[counter]));
+    close(listenfd);
+    unlink(path);
+    return D_SUCCESS;
+}
@@ -0,0 +1,108 @@
+/*
+#
+# Copyright (C) 2010 by Chris Evich <cevich@redhat.com>
+#
+#   This library is free software; you can redistribute it and/or
+#   modify it under the terms of the GNU Lesser General Public
+#   License as published by the Free Software Foundation; either
+#   version 2.1 of the License, or (at your option) any later version.
+#
+#   This library is distributed in the hope that it will be useful,
+#   but WITHOUT ANY WARRANTY; without even the implied warranty of
+#   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+#   Lesser General Public License for more details.
+#
+#   You should have received a copy of the GNU Lesser General Public
+#   License along with this library; if not, write to the Free Software
+#   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+#
+*/
+
+#ifndef _RINGWRAPD_H
+#define _RINGWRAPD_H
+
+/**************************************************
+********************* MACROS
+**************************************************/
+#define DAEMON_SOCKET "/tmp/"PROGNAM"d.sock" /* default control socket */
+#define DAEMON_RINGS REGISTRY_SLOTS /* most rings watched at once */
+#define DAEMON_CLIENTS 64 /* most clients connected at once */
+#define DAEMON_LINELEN 1024 /* longest command or reply line */
+#define DAEMON_RESCAN 1 /* seconds between looking for new or gone rings */
+
+/**************************************************
+********************* TYPES
+**************************************************/
+
+typedef enum dexitcode_e {
+    D_SUCCESS, /* Normal, successful exit */
+    D_DONTUSE, /* Needed to preserve common exit_group(1) */
+    D_ARGS, /* Error parsing command line arguments */
+    D_SOCKET, /* Could not listen on control socket */
+} dexitcode_t;
+
+typedef struct ringd_s {
+    shared_t *shared; /* ring watched, or NULL if entry is free */
+    int stop; /* set to make watcher (and evictor) return */
+    int hosting; /* 1 if evictor runs this ring's eviction worker */
+    pthread_t watcher; /* turns events_notify() wakeups into events */
+    pthread_t evictor; /* runs evictworker() while hosting */
+    counters_t counters; /* as of the last events sent */
+    unsigned long evicted; /* as of the last events sent */
+} ringd_t;
+
+typedef struct client_s {
+    int fd; /* connection, or -1 if entry is free */
+    int subscribed; /* 1 = events are sent to this client */
+    char filter[REGISTRY_NAMELEN]; /* only events of this ring or "" */
+    size_t linelen; /* bytes of partial command in line */
+    char line[DAEMON_LINELEN]; /* command being received */
+} client_t;
+
+/**************************************************
+********************* FUNCTION DEFINITIONS
+**************************************************/
+
+/* sends line to client, unless it can't take it without blocking,
+   then hangs it up.  Requires clientlock. */
+void client_send(client_t *client, const char const *line);
+
+/* sends event line about ring name to every subscribed client */
+void broadcast(const char const *name, const char const *line);
+
+/* sends events for what changed in ringd since last time */
+void ringd_events(ringd_t *ringd);
+
+/* thread waiting for events on a ringd until ringd->stop */
+void *ringd_watcher(void *arg);
+
+/* thread running evictworker() on a ringd */
+void *ringd_evictor(void *arg);
+
+/* starts watching shared (and hosting it's eviction if possible), or
+   frees it and returns NULL when out of entries */
+ringd_t *ringd_attach(shared_t *shared);
+
+/* stops watching ringd, handing back eviction, and frees it's shared */
+void ringd_detach(ringd_t *ringd);
+
+/* returns ringd watching ring name, attaching it if it exists, or NULL */
+ringd_t *ringd_find(const char const *name);
+
+/* attaches new registry rings and detaches destroyed ones */
+void ringd_rescan(void);
+
+/* executes one command line from client, sending it's reply */
+void command(client_t *client, char *line);
+
+/* reads whatever client sent, executing complete lines.  Returns 
+   non-zero once client should be hung up */
+int client_read(client_t *client);
+
+/* returns listening socket bound to path or -1 on failure */
+int listen_socket(const char const *path);
+
+/* main program function */
+int main(int argc, char * const *argv);
+
+#endif /* _RINGWRAPD_H */
@@ -0,0 +1,260 @@
+#!/bin/sh
+#
+# Copyright (C) 2010 by Chris Evich <cevich@redhat.com>
+#
+#   This library is free software; you can redistribute it and/or
+#   modify it under the terms of the GNU Lesser General Public
+#   License as published by the Free Software Foundation; either
+#   version 2.1 of the License, or (at your option) any later version.
+#
+#   This library is distributed in the hope that it will be useful,
+#   but WITHOUT ANY WARRANTY; without even the implied warranty of
+#   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+#   Lesser General Public License for more details.
+#
+#   You should have received a copy of the GNU Lesser General Public
+#   License along with this library; if not, write to the Free Software
+#   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+#
+#
+#Use: stress.sh [level...]
+#     Launches level (default 10 100 1000 2000) executions of a trivial
+#     command through ringwrap all at once, while another process keeps
+#     flipping --begin and --end, for each level in turn.  Afterwards
+#     checks the shared counters add up to what was launched, the logring
+#     holds exactly keep entries (or every wrapped run, if fewer) and that
+#     outdir holds no run directory the logring doesn't.  Then, with
+#     --arena, logs more than keep runs of echo one by one, launches a
+#     burst racing a --runs 1 window and checks every logged run still
+#     extracts, the oldest with it's own output.  Last, with --recycle
+#     and the default wrapper (or one imitating strace -ff without it),
+#     checks evicted directories get recycled and hold no stale files.
+#     Prints CSV "level,seconds,execs_per_sec,wrapped,lock_p50_ns,
+#     lock_p90_ns,lock_p99_ns,lock_max_ns" to stdout.  Lock waits are only
+#     known from the "bench:" line a ringwrap built with -DBENCHMARK (see
+#     'make stress') prints, otherwise they are left empty.  Exits
+#     non-zero if any check failed.
+#Env: RINGWRAP      ringwrap binary to use (default ./ringwrap)
+#     RINGWRAPFLAGS extra options for every ringwrap, e.g. -r or -n
+#     COMMAND       command to execute (default /bin/true)
+#     KEEP          output directories to retain (default 10)
+#     DRAINWAIT     seconds to wait for the eviction worker (default 30)
+
+RINGWRAP=${RINGWRAP:-./ringwrap}
+COMMAND=${COMMAND:-/bin/true}
+KEEP=${KEEP:-10}
+DRAINWAIT=${DRAINWAIT:-30}
+LEVELS=${*:-10 100 1000 2000}
+UNIQUE="stress$$"
+WRAPPER="env RINGWRAP_OUTPUT=@@@" # creates a run directory, runs command
+WORK=$(mktemp -d) || exit 1
+OUTDIR="$WORK/out/"
+RW="$RINGWRAP $RINGWRAPFLAGS -u $UNIQUE"
+FAILED=0
+ARENAWRAPPER="sh -c 'exec \"\$0\" \"\$@\" > @@@'" # command's output
+RA="$RINGWRAP $RINGWRAPFLAGS -u ${UNIQUE}arena"
+# like strace -ff, one <command>.<PID> file per run, $0 is just the flag
+FFWRAPPER="sh -c 'echo \$\$ > \"\$1.\$\$\"; shift; exec \"\$@\"' -ff @@@"
+RC="$RINGWRAP $RINGWRAPFLAGS -u ${UNIQUE}recycle"
+trap '$RW -f $COMMAND >/dev/null 2>&1; $RA -f echo >/dev/null 2>&1
+      $RC -f $COMMAND >/dev/null 2>&1; rm -rf "$WORK"' EXIT
+
+now() {
+    date +%s%N
+}
+
+fail() {
+    echo "FAIL: $*" >&2
+    FAILED=1
+}
+
+# stat <name>: prints value of one --stats line
+stat() {
+    $RW -s $COMMAND 2>&1 | awk -v name="$1" -F': ' \
+        '$1 == "\t" name { split($2, v, " "); print v[1]; exit }'
+}
+
+# toggle: flip tracing until $WORK/toggle goes away, counting switches
+toggle() {
+    begins=0
+    ends=0
+    while [ -f "$WORK/toggle" ]; do
+        $RW -b $COMMAND >/dev/null 2>&1 && begins=$((begins + 1))
+        $RW -e $COMMAND >/dev/null 2>&1 && ends=$((ends + 1))
+    done
+    echo "$begins $ends" > "$WORK/toggled"
+}
+
+# run_level <level>: launch level executions at once, then summarize
+run_level() {
+    level=$1
+    : > "$WORK/log"
+    : > "$WORK/failures"
+    : > "$WORK/toggle"
+    wrapped=$(stat "Wrapped Executions")
+    toggle &
+    toggler=$!
+    start=$(now)
+    ( # own shell, so wait doesn't include the toggler
+        counter=0
+        while [ $counter -lt $level ]; do
+            { $RW $COMMAND 2>> "$WORK/log" || \
+                echo $? >> "$WORK/failures"; } &
+            counter=$((counter + 1))
+        done
+        wait
+    )
+    end=$(now)
+    rm -f "$WORK/toggle"
+    wait $toggler
+    [ -s "$WORK/failures" ] && \
+        fail "level $level: $(wc -l < "$WORK/failures") executions failed"
+    awk '$1 == "bench:" && $2 == "wrapped=1" {
+             split($4, kv, "=")
+             print kv[2]
+         }' "$WORK/log" | sort -n > "$WORK/lockwaits"
+    wrapped=$(($(stat "Wrapped Executions") - wrapped))
+    echo "$level,$(awk -v ns=$((end - start)) -v n=$level 'BEGIN {
+              printf "%.3f,%.1f", ns / 1e9, n / (ns / 1e9) }'),$wrapped,$(
+          awk '{ v[NR] = $1 }
+               END {
+                   if (NR == 0) { print ",,,"; exit }
+                   split("50 90 99", p, " ")
+                   for (i = 1; i <= 3; i++) {
+                       idx = int(NR * p[i] / 100 + 0.999999)
+                       printf "%d,", v[idx < 1 ? 1 : idx]
+                   }
+                   print v[NR]
+               }' "$WORK/lockwaits")"
+}
+
+# check <launched> <begins> <ends>: verify shared data after all levels
+check() {
+    wrapped=$(stat "Wrapped Executions")
+    unwrapped=$(stat "Unwrapped Executions")
+    [ $((wrapped + unwrapped)) -eq $1 ] || \
+        fail "$wrapped wrapped + $unwrapped unwrapped executions, $1 launched"
+    [ "$(stat Begins)" -eq $2 ] || fail "$(stat Begins) begins, $2 switched on"
+    [ "$(stat Ends)" -eq $3 ] || fail "$(stat Ends) ends, $3 switched off"
+    # eviction worker removes directories the logring dropped
+    waited=0
+    while [ "$(stat "Eviction Backlog")" -ne 0 ] && \
+          [ $waited -lt $DRAINWAIT ]; do
+        sleep 1
+        waited=$((waited + 1))
+    done
+    [ "$(stat "Eviction Failures")" -eq 0 ] || \
+        fail "$(stat "Eviction Failures") eviction failures"
+    expected=$KEEP
+    [ $wrapped -lt $KEEP ] && expected=$wrapped
+    logged=$(stat Logged)
+    [ $logged -eq $expected ] || \
+        fail "logring holds $logged entries, expected $expected"
+    # --recycle's hidden spares belong to no run
+    ondisk=$(find "$OUTDIR" -mindepth 1 -maxdepth 1 -type d \
+             ! -name '.spare-*' | wc -l)
+    [ $ondisk -eq $logged ] || \
+        fail "$ondisk run directories in $OUTDIR, logring holds $logged"
+}
+
+# check_arena: runs given to the arena stay extractable while logged
+check_arena() {
+    $RA -w "$ARENAWRAPPER" -k $KEEP -o "$WORK/arena/" --arena 4K -i echo \
+        >/dev/null 2>&1 || { fail "initializing --arena"; return; }
+    $RA -b echo >/dev/null 2>&1
+    counter=1
+    while [ $counter -le $((KEEP + 3)) ]; do
+        $RA echo "run$counter" >/dev/null 2>&1
+        counter=$((counter + 1))
+    done
+    # claims losing the window to the one wrapped run skip sequences
+    $RA -b --runs 1 echo >/dev/null 2>&1
+    counter=0
+    while [ $counter -lt 100 ]; do
+        $RA echo burst >/dev/null 2>&1 &
+        counter=$((counter + 1))
+    done
+    wait
+    logged=$($RA -s echo 2>&1 | awk -F': ' \
+             '$1 == "\tLogged" { split($2, v, " "); print v[1]; exit }')
+    [ "$logged" -eq $KEEP ] || \
+        fail "arena logring holds $logged entries, expected $KEEP"
+    oldest=$($RA --extract 0 echo 2>&1 | sed -n 's/^Extracted run to //p')
+    counter=1
+    while [ $counter -lt $KEEP ]; do
+        $RA --extract $counter echo >/dev/null 2>&1 || \
+            fail "extracting logged arena run $counter"
+        counter=$((counter + 1))
+    done
+    [ "$(cat "$oldest" 2>/dev/null)" = "run5" ] || \
+        fail "oldest arena run holds '$(cat "$oldest" 2>/dev/null)', not run5"
+    $RA -f echo >/dev/null 2>&1
+}
+
+# check_recycle: per PID files of -ff wrappers don't outlive their run
+check_recycle() {
+    if command -v strace >/dev/null 2>&1; then
+        $RC -k $KEEP -o "$WORK/recycle/" --recycle -i $COMMAND \
+            >/dev/null 2>&1 || { fail "initializing --recycle"; return; }
+    else
+        $RC -w "$FFWRAPPER" -k $KEEP -o "$WORK/recycle/" --recycle \
+            -i $COMMAND >/dev/null 2>&1 || \
+            { fail "initializing --recycle"; return; }
+    fi
+    $RC -s $COMMAND 2>&1 | grep -q "Recycling: on, keeping directories" || \
+        fail "--recycle keeps a file the -ff wrapper never writes again"
+    $RC -b $COMMAND >/dev/null 2>&1
+    counter=0
+    while [ $counter -lt $((KEEP * 3)) ]; do
+        $RC $COMMAND >/dev/null 2>&1 || fail "recycled run $counter failed"
+        counter=$((counter + 1))
+    done
+    waited=0
+    while [ "$($RC -s $COMMAND 2>&1 | awk -F': ' \
+               '$1 == "\tEviction Backlog" { print $2; exit }')" != "0" ] \
+          && [ $waited -lt $DRAINWAIT ]; do
+        sleep 1
+        waited=$((waited + 1))
+    done
+    $RC -s $COMMAND > "$WORK/recyclestats" 2>&1
+    recycled=$(awk -F': ' '$1 == "\tRecycled" { print $2; exit }' \
+               "$WORK/recyclestats")
+    [ "${recycled:-0}" -gt 0 ] || fail "no run directory was recycled"
+    grep -q "Eviction Failures: 0" "$WORK/recyclestats" || \
+        fail "recycling: $(grep "Eviction Failures" "$WORK/recyclestats")"
+    # one file per (single process) run, spares empty
+    stale=$(find "$WORK/recycle" -mindepth 1 -maxdepth 1 -type d | \
+            while read dir; do
+                files=$(find "$dir" -mindepth 1 | wc -l)
+                case "$dir" in
+                    */.spare-*) [ $files -eq 0 ] || echo "$dir" ;;
+                    *) [ $files -eq 1 ] || echo "$dir" ;;
+                esac
+            done)
+    [ -z "$stale" ] || fail "recycled directories with stale files: $stale"
+    $RC -f $COMMAND >/dev/null 2>&1
+}
+
+if ! $RW $COMMAND 2>&1 | grep -q "^bench:"; then
+    echo "WARNING: $RINGWRAP not built with -DBENCHMARK," \
+         "lock waits not measured" >&2
+fi
+$RW -w "$WRAPPER" -k $KEEP -o "$OUTDIR" -i $COMMAND >/dev/null 2>&1 \
+    || { echo "ERROR: Initializing $UNIQUE failed" >&2; exit 1; }
+
+echo "level,seconds,execs_per_sec,wrapped,lock_p50_ns,lock_p90_ns,lock_p99_ns,lock_max_ns"
+launched=0
+begins=0
+ends=0
+for level in $LEVELS; do
+    run_level $level
+    launched=$((launched + level))
+    read toggledon toggledoff < "$WORK/toggled"
+    begins=$((begins + toggledon))
+    ends=$((ends + toggledoff))
+done
+check $launched $begins $ends
+check_arena
+check_recycle
+[ $FAILED -eq 0 ] && echo "PASS: $launched executions consistent" >&2
+exit $FAILED
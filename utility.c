@@ -21,11 +21,15 @@
 #include <errno.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <fcntl.h>
+#include <dirent.h>
 #include <unistd.h>
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <math.h>
+#include <limits.h>
+#include <time.h>
 #include "utility.h"
 
 /**************************************************
@@ -48,13 +52,86 @@ char **utility_argvcopy(int argc, const char const * const *argv) {
 }   
 
 void utility_argvcfree(char **argv) {
-    char *argvp=argv[0];
-    for(;*argvp != '\0'; argvp++)
-        if ((argvp != NULL) && (*argvp != '\0'))
-            free(argvp);
+    char **argvp=argv;
+
+    if (argv == NULL)
+        return;
+    for(;*argvp != NULL; argvp++)
+        free(*argvp);
     free(argv);
 }
 
+char **utility_argvsplit(const char const *source) {
+    char **argv=NULL;
+    char *word=NULL;
+    size_t argc=0;
+    size_t wordlen=0;
+    size_t source_len=0;
+    char quote='\0'; /* quote character in effect or \0 */
+    int inword=0;
+
+    if (source == NULL)
+        return NULL;
+    source_len = strlen(source);
+    /* can't possibly be more words than every other character */
+    argv = malloc(((source_len / 2) + 2) * sizeof(char *));
+    memset(argv, 0, ((source_len / 2) + 2) * sizeof(char *));
+    word = malloc(source_len + 1);
+    for (;*source != '\0'; source++) {
+        if ((quote == '\0') && ((*source == ' ') || (*source == '\t') ||
+                                (*source == '\n'))) {
+            if (inword == 1) { /* end of word */
+                word[wordlen] = '\0';
+                argv[argc++] = utility_strcpy(word);
+                wordlen = 0;
+                inword = 0;
+            }
+            continue;
+        }
+        inword = 1;
+        if ((quote != '\'') && (*source == '\\') && (*(source + 1) != '\0')) {
+            /* inside "" only a few characters are special */
+            if ((quote == '\0') || (strchr("\"\\$`", *(source + 1)) != NULL))
+                source++;
+            word[wordlen++] = *source;
+        } else if ((quote == '\0') && ((*source == '\'') || (*source == '"')))
+            quote = *source; /* open quote */
+        else if ((quote != '\0') && (*source == quote))
+            quote = '\0'; /* close quote */
+        else
+            word[wordlen++] = *source;
+    }
+    if (inword == 1) {
+        word[wordlen] = '\0';
+        argv[argc++] = utility_strcpy(word);
+    }
+    free(word);
+    if (quote != '\0') { /* unbalanced */
+        utility_argvcfree(argv);
+        return NULL;
+    }
+    return argv;
+}
+
+char **utility_argvcat(char * const *first, char * const *second) {
+    char **argv=NULL;
+    size_t len1=0;
+    size_t len2=0;
+    size_t counter=0;
+
+    if (first != NULL)
+        len1 = utility_ptr_arr_len((const void const **)first);
+    if (second != NULL)
+        len2 = utility_ptr_arr_len((const void const **)second);
+    argv = malloc((len1 + len2 + 1) * sizeof(char *));
+    memset(argv, 0, (len1 + len2 + 1) * sizeof(char *));
+    for (;counter < len1; counter++)
+        argv[counter] = utility_strcpy(first[counter]);
+    for (;counter < (len1 + len2); counter++)
+        argv[counter] = utility_strcpy(second[counter - len1]);
+    return argv;
+}
+
 char *utility_strcpy(const char const *source) {
     char *newstring = NULL;
     size_t len=0;
@@ -120,8 +197,8 @@ char *utility_only_alnum(const char const *source) {
     if ((source == NULL) || (*source == '\0'))
         return utility_strcpy("");
     source_len = strlen(source);
-    newstr = malloc(source_len);
-    memset(newstr,0,source_len);
+    newstr = malloc(source_len + 1); /* room for \0 */
+    memset(newstr,0,source_len + 1);
     for (;src_counter < source_len; src_counter++) {
         if (utility_is_alnum(source[src_counter]) == 0) 
             continue;
@@ -133,25 +210,29 @@ char *utility_only_alnum(const char const *source) {
     return result;
 }
 
-/* TODO: test for needle location at: start, middle, end, */
 char *utility_strsnr(char *haystack, 
                      const char const *needle, 
                      const char const *replacement) {
     char *result = NULL;
-    char *other_haystack=NULL;
-
-    result = strstr(haystack, needle);
-    if ((result == NULL) || (result == haystack))
-        return haystack; /* No (more) needles found */
-    else { /* found needle */
-        *result = '\0'; /* split haystack in two */
-        result += strlen(needle); /* point at start of second half */
-        /* search remaining string */
-        other_haystack = utility_strsnr(result, needle, replacement);
-        /* combine result */
-        other_haystack = utility_strcat3(haystack, replacement, other_haystack);
+    char *found = NULL;
+    char *oldresult = NULL;
+    char *remaining = haystack;
+    size_t needle_len = strlen(needle);
+
+    if (strstr(haystack, needle) == NULL)
+        return haystack; /* No needles found */
+    while ((found = strstr(remaining, needle)) != NULL) {
+        *found = '\0'; /* split off part before needle */
+        oldresult = result;
+        result = utility_strcat3(result, remaining, replacement);
+        free(oldresult);
+        remaining = found + needle_len;
     }
-    return other_haystack;
+    oldresult = result;
+    result = utility_strcat(result, remaining);
+    free(oldresult);
+    free(haystack);
+    return result;
 }
 
 char *utility_fixpath(const char const *path) {
@@ -174,6 +255,128 @@ char *utility_fullpath(const char const *path, const char const *filename) {
     return fullpath;
 }
 
+int utility_rmtree(int dirfd, const char const *name, const char const *path) {
+    int fd=-1;
+    int failures=0;
+    DIR *dir=NULL;
+    struct dirent *entry=NULL;
+    char *entrypath=NULL;
+
+    fd = openat(dirfd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    if (fd < 0) {
+        if ((errno == ENOTDIR) || (errno == ELOOP)) { /* file or symlink */
+            if (unlinkat(dirfd, name, 0) == 0)
+                return 0;
+        }
+        fprintf(stderr, "ERROR: Remove %s: %s\n", path, strerror(errno));
+        return 1;
+    }
+    dir = fdopendir(fd); /* now owns fd */
+    while ((entry = readdir(dir)) != NULL) {
+        if ((strcmp(entry->d_name, ".") == 0) ||
+            (strcmp(entry->d_name, "..") == 0))
+            continue;
+        if ((entry->d_type == DT_DIR) || (entry->d_type == DT_UNKNOWN)) {
+            entrypath = utility_fullpath(path, entry->d_name);
+            failures += utility_rmtree(fd, entry->d_name, entrypath);
+            free(entrypath);
+        } else if (unlinkat(fd, entry->d_name, 0) != 0) {
+            entrypath = utility_fullpath(path, entry->d_name);
+            fprintf(stderr, "ERROR: Remove %s: %s\n", entrypath, 
+                    strerror(errno));
+            free(entrypath);
+            failures++;
+        }
+    }
+    closedir(dir);
+    if (unlinkat(dirfd, name, AT_REMOVEDIR) != 0) {
+        fprintf(stderr, "ERROR: Remove %s: %s\n", path, strerror(errno));
+        failures++;
+    }
+    return failures;
+}
+
+unsigned long utility_dirsize(int dirfd, const char const *name) {
+    int fd=-1;
+    unsigned long total=0;
+    DIR *dir=NULL;
+    struct dirent *entry=NULL;
+    struct stat s;
+
+    if (fstatat(dirfd, name, &s, AT_SYMLINK_NOFOLLOW) != 0)
+        return 0;
+    if (!S_ISDIR(s.st_mode))
+        return S_ISREG(s.st_mode) ? s.st_size : 0;
+    fd = openat(dirfd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    if (fd < 0)
+        return 0;
+    dir = fdopendir(fd); /* now owns fd */
+    while ((entry = readdir(dir)) != NULL) {
+        if ((strcmp(entry->d_name, ".") == 0) ||
+            (strcmp(entry->d_name, "..") == 0))
+            continue;
+        total += utility_dirsize(fd, entry->d_name);
+    }
+    closedir(dir);
+    return total;
+}
+
+long utility_strtosize(const char const *str) {
+    char *endptr=NULL;
+    long size=0;
+
+    if ((str == NULL) || (*str == '\0') || (*str == '-'))
+        return -1;
+    errno = 0;
+    size = strtol(str, &endptr, 10);
+    if ((errno != 0) || (endptr == str))
+        return -1;
+    switch (*endptr) { /* overflow is checked before it can happen */
+        case 'G': case 'g':
+            if (size > LONG_MAX / 1024)
+                return -1;
+            size *= 1024; /* fall through */
+        case 'M': case 'm':
+            if (size > LONG_MAX / 1024)
+                return -1;
+            size *= 1024; /* fall through */
+        case 'K': case 'k':
+            if (size > LONG_MAX / 1024)
+                return -1;
+            size *= 1024;
+            endptr++;
+            break;
+        case '\0': break;
+        default: return -1;
+    }
+    if ((*endptr != '\0') || (size < 0))
+        return -1;
+    return size;
+}
+
+long utility_strtoduration(const char const *str) {
+    char *endptr=NULL;
+    long seconds=0;
+
+    if ((str == NULL) || (*str == '\0') || (*str == '-'))
+        return -1;
+    errno = 0;
+    seconds = strtol(str, &endptr, 10);
+    if ((errno != 0) || (endptr == str))
+        return -1;
+    switch (*endptr) {
+        case 'D': case 'd': seconds *= 24; /* fall through */
+        case 'H': case 'h': seconds *= 60; /* fall through */
+        case 'M': case 'm': seconds *= 60; /* fall through */
+        case 'S': case 's': endptr++; break;
+        case '\0': break;
+        default: return -1;
+    }
+    if ((*endptr != '\0') || (seconds < 0))
+        return -1;
+    return seconds;
+}
+
 off_t utility_filesize(const char const *pathfile) {
     struct stat s;
     int r=-1;
@@ -188,6 +391,22 @@ off_t utility_filesize(const char const *pathfile) {
     return s.st_size;
 }
 
+unsigned long utility_usecsince(const struct timespec *start) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return ((now.tv_sec - start->tv_sec) * 1000000UL) +
+           (now.tv_nsec / 1000) - (start->tv_nsec / 1000);
+}
+
+unsigned long utility_nsecsince(const struct timespec *start) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return ((now.tv_sec - start->tv_sec) * 1000000000UL) +
+           now.tv_nsec - start->tv_nsec;
+}
+
 long utility_ptr_arr_len(const void const **arr) {
     long len=0;
 
@@ -24,6 +24,7 @@
 /* users of this need: 
     #include <sys/types.h>
     #include <string.h>
+    #include <time.h>
 */
 
 /**************************************************
@@ -58,6 +59,16 @@ char **utility_argvcopy(int argc, const char const * const *argv);
 /* Free null-terminated copy returned by utility_argvcopy */
 void utility_argvcfree(char **argv);
 
+/* Returns newly allocated null-terminated vector of words in source, split
+   on whitespace like /bin/sh would, honoring '', "" and \ quoting, but
+   no other shell syntax.  Returns NULL on unbalanced quotes. 
+   Free with utility_argvcfree */
+char **utility_argvsplit(const char const *source);
+
+/* Returns newly allocated null-terminated vector holding copies of first's
+   strings followed by second's.  Free with utility_argvcfree */
+char **utility_argvcat(char * const *first, char * const *second);
+
 /* Returns NULL if source contains no \0 w/in STR_LEN_MAX
    otherwise returns freshly allocated copy of source string */
 char *utility_strcpy(const char const *source);
@@ -77,7 +88,8 @@ int utility_is_alnum(char what);
 char *utility_only_alnum(const char const *source);
 
 /* Returns possibly moved pointer to haystack with all instances of needle
-   replaced by replacement none of which can be NULL */
+   replaced by replacement none of which can be NULL.  haystack is freed
+   if it was moved. */
 char *utility_strsnr(char *haystack,
                      const char const *needle, 
                      const char const *replacement);
@@ -89,9 +101,33 @@ char *utility_fixpath(const char const *path);
 /* returns newly allocated concatenation of fixedpath and filename */
 char *utility_fullpath(const char const *path, const char const *filename);
 
+/* recursively removes name, relative to open directory dirfd, never
+   following symlinks or re-resolving paths.  path is name's full path,
+   only used in error messages. Returns number of entries not removed */
+int utility_rmtree(int dirfd, const char const *name, const char const *path);
+
+/* returns total bytes of regular files under name, relative to open
+   directory dirfd, never following symlinks.  Unreadable entries count
+   as zero. */
+unsigned long utility_dirsize(int dirfd, const char const *name);
+
+/* returns number of bytes in str, a decimal number with optional K, M
+   or G (1024 based) suffix, or -1 if str is not one. */
+long utility_strtosize(const char const *str);
+
+/* returns number of seconds in str, a decimal number with optional s, m,
+   h or d suffix, or -1 if str is not one. */
+long utility_strtoduration(const char const *str);
+
 /* returns the size of path/file or -1 of failure */
 off_t utility_filesize(const char const *pathfile);
 
+/* returns microseconds elapsed on CLOCK_MONOTONIC since start */
+unsigned long utility_usecsince(const struct timespec *start);
+
+/* returns nanoseconds elapsed on CLOCK_MONOTONIC since start */
+unsigned long utility_nsecsince(const struct timespec *start);
+
 /* returns number of pointers in null-terminated array if pointers arr 
    does not count the null terminator! */
 long utility_ptr_arr_len(const void const **arr);
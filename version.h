@@ -26,8 +26,8 @@
 **************************************************/
 #define PROGNAM "ringwrap"
 #define PROGVER_X_s "1"
-#define PROGVER_Y_s "2"
-#define PROGVER_Z_s "1"
+#define PROGVER_Y_s "3"
+#define PROGVER_Z_s "0"
 #define PROGREL_s "1"
 #define PROGVER_X strtoul(PROGVER_X_s, NULL, 0)
 #define PROGVER_Y strtoul(PROGVER_Y_s, NULL, 0)